@@ -0,0 +1,38 @@
+#include <windows.h>
+#include <new>
+#include <cstdlib>
+#include <cstdint>
+#include "arena.h"
+
+// Replaces operator new so that the number of heap allocations made by each
+// export can be checked from SQL, by calling ALLOC_COUNT before and after.
+// BSTRs returned by the exports come from SysAllocStringLen, so aren't counted.
+
+static thread_local uint64_t alloc_count = 0;
+
+void* operator new(size_t size) {
+	alloc_count++;
+
+	if (auto p = malloc(size == 0 ? 1 : size))
+		return p;
+
+	throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept {
+	free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+	free(p);
+}
+
+extern "C" __declspec(dllexport) int64_t ALLOC_COUNT() noexcept {
+	return (int64_t)alloc_count;
+}
+
+// Whether the thread's arena has had everything given back, as it should
+// have between calls.
+extern "C" __declspec(dllexport) BOOL ARENA_EMPTY() noexcept {
+	return arena::get().empty();
+}
@@ -0,0 +1,38 @@
+#include "arena.h"
+
+using namespace std;
+
+// Chunks come from new[], so offsets only need aligning to anything up to the
+// default new alignment.
+void* arena::allocate(size_t n, size_t align) {
+	while (current < chunks.size()) {
+		auto& c = chunks[current];
+		auto p = (used + align - 1) & ~(align - 1);
+
+		if (p + n <= c.size) {
+			used = p + n;
+			return c.data.get() + p;
+		}
+
+		// move on to the next chunk, if an earlier scope left one behind
+		current++;
+		used = 0;
+	}
+
+	auto size = max(chunk_size, n);
+
+	chunks.push_back({make_unique_for_overwrite<byte[]>(size), size});
+	current = chunks.size() - 1;
+	used = n;
+
+	return chunks.back().data.get();
+}
+
+void arena::release(size_t chunk_num, size_t offset) noexcept {
+	current = chunk_num;
+	used = offset;
+
+	// don't keep hold of a big document's memory once everything's been given back
+	if (current == 0 && used == 0 && !chunks.empty())
+		chunks.resize(chunks.front().size == chunk_size ? 1 : 0);
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+// A bump allocator, one per thread. Nothing is freed individually - an
+// arena_scope gives back everything allocated while it was alive in one go.
+class arena {
+public:
+	static arena& get() noexcept {
+		thread_local arena a;
+
+		return a;
+	}
+
+	void* allocate(size_t n, size_t align);
+
+	// True if everything that's been allocated has been given back, i.e. no
+	// scope has been left open and nothing was allocated outside one.
+	bool empty() const noexcept {
+		return current == 0 && used == 0;
+	}
+
+private:
+	friend class arena_scope;
+
+	struct chunk {
+		std::unique_ptr<std::byte[]> data;
+		size_t size;
+	};
+
+	static constexpr size_t chunk_size = 65536;
+
+	void release(size_t chunk_num, size_t offset) noexcept;
+
+	std::vector<chunk> chunks;
+	size_t current = 0, used = 0;
+};
+
+// Scopes can be nested - each one only gives back what was allocated after it started.
+class arena_scope {
+public:
+	arena_scope() noexcept : a(arena::get()), chunk_num(a.current), offset(a.used) { }
+
+	~arena_scope() {
+		a.release(chunk_num, offset);
+	}
+
+	arena_scope(const arena_scope&) = delete;
+	arena_scope& operator=(const arena_scope&) = delete;
+
+private:
+	arena& a;
+	size_t chunk_num, offset;
+};
+
+// Stateless, so that it can be given to nlohmann::basic_json, which
+// default-constructs its allocators.
+template<typename T>
+class arena_allocator {
+public:
+	using value_type = T;
+
+	arena_allocator() noexcept = default;
+
+	template<typename U>
+	arena_allocator(const arena_allocator<U>&) noexcept { }
+
+	T* allocate(size_t n) {
+		return (T*)arena::get().allocate(n * sizeof(T), alignof(T));
+	}
+
+	void deallocate(T*, size_t) noexcept {
+	}
+
+	template<typename U>
+	bool operator==(const arena_allocator<U>&) const noexcept {
+		return true;
+	}
+};
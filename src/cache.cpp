@@ -0,0 +1,124 @@
+#include "jsonfunc.h"
+#include "cache.h"
+#include <cstring>
+
+using namespace std;
+
+static constexpr size_t entry_overhead = 128; // roughly, for the list and map nodes
+
+document_cache& document_cache::get() noexcept {
+	static document_cache c;
+
+	return c;
+}
+
+// Not cryptographic - a multiply and shift for every 8 bytes, so that it costs
+// far less than the parse it's saving. The length is mixed in first, and
+// collisions are caught by comparing the input.
+uint64_t document_cache::hash(string_view input, bool utf16) noexcept {
+	static constexpr uint64_t mul = 0x9e3779b97f4a7c15;
+	uint64_t h = (input.length() * 2 + (utf16 ? 1 : 0)) * mul;
+
+	while (input.length() >= sizeof(uint64_t)) {
+		uint64_t w;
+
+		memcpy(&w, input.data(), sizeof(w));
+		h = (h ^ w) * mul;
+		h ^= h >> 29;
+		input.remove_prefix(sizeof(w));
+	}
+
+	for (auto c : input) {
+		h = (h ^ (uint8_t)c) * mul;
+	}
+
+	return h ^ (h >> 32);
+}
+
+shared_ptr<const string> document_cache::find(string_view input, bool utf16) {
+	auto h = hash(input, utf16);
+	lock_guard lock(mut);
+
+	auto it = index.find(h);
+
+	if (it == index.end() || it->second->utf16 != utf16 || it->second->input != input) {
+		misses++;
+		return nullptr;
+	}
+
+	lru.splice(lru.begin(), lru, it->second);
+	hits++;
+
+	return it->second->doc;
+}
+
+shared_ptr<const string> document_cache::insert(string_view input, bool utf16, string doc) {
+	auto h = hash(input, utf16);
+	auto size = input.length() + doc.length() + entry_overhead;
+	auto ret = make_shared<const string>(move(doc));
+
+	if (size > limit.load(memory_order_relaxed))
+		return ret;
+
+	lock_guard lock(mut);
+	auto l = limit.load();
+
+	if (size > l) // lowered while we weren't holding the lock
+		return ret;
+
+	if (auto it = index.find(h); it != index.end()) {
+		bytes -= it->second->input.length() + it->second->doc->length() + entry_overhead;
+		lru.erase(it->second);
+		index.erase(it);
+	}
+
+	evict(l - size);
+
+	lru.push_front({h, utf16, string{input}, ret});
+	index.emplace(h, lru.begin());
+	bytes += size;
+
+	return ret;
+}
+
+void document_cache::evict(size_t target) {
+	while (bytes > target && !lru.empty()) {
+		auto& e = lru.back();
+
+		bytes -= e.input.length() + e.doc->length() + entry_overhead;
+		index.erase(e.hash);
+		lru.pop_back();
+		evictions++;
+	}
+}
+
+void document_cache::set_limit(size_t l) {
+	lock_guard lock(mut);
+
+	limit = l;
+	evict(l);
+}
+
+string document_cache::stats() {
+	lock_guard lock(mut);
+
+	return "{\"hits\":" + to_string(hits) + ",\"misses\":" + to_string(misses) +
+		",\"evictions\":" + to_string(evictions) + ",\"entries\":" + to_string(lru.size()) +
+		",\"bytes\":" + to_string(bytes) + ",\"limit\":" + to_string(limit.load()) + "}";
+}
+
+// Sets how much memory the cache can use, in bytes - 0, the default, turns it off.
+extern "C" __declspec(dllexport) void JSON_CACHE_LIMIT(UINT64 bytes) noexcept {
+	try {
+		document_cache::get().set_limit((size_t)bytes);
+	} catch (...) {
+	}
+}
+
+extern "C" __declspec(dllexport) BSTR JSON_CACHE_STATS() noexcept {
+	try {
+		return bstr(document_cache::get().stats());
+	} catch (...) {
+		return nullptr;
+	}
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <list>
+#include <unordered_map>
+
+// Documents that have already been parsed, in the binary form that JSON_BINARY
+// produces, so that any function run over the same document again can read that
+// rather than parsing it. Entries are found by a hash and the length of the
+// input, which is kept too so that a hit can be checked against it. It's off
+// until JSON_CACHE_LIMIT gives it some memory.
+class document_cache {
+public:
+	static document_cache& get() noexcept;
+
+	bool enabled() const noexcept {
+		return limit.load(std::memory_order_relaxed) != 0;
+	}
+
+	// input is the bytes of the JSON as it was passed in, and utf16 says which
+	// encoding they're in, so that the same text in each is told apart.
+	std::shared_ptr<const std::string> find(std::string_view input, bool utf16);
+
+	// Returns doc, whether or not there was room for it.
+	std::shared_ptr<const std::string> insert(std::string_view input, bool utf16, std::string doc);
+
+	void set_limit(size_t bytes);
+	std::string stats();
+
+private:
+	struct entry {
+		uint64_t hash;
+		bool utf16;
+		std::string input;
+		std::shared_ptr<const std::string> doc;
+	};
+
+	static uint64_t hash(std::string_view input, bool utf16) noexcept;
+	void evict(size_t target);
+
+	std::mutex mut;
+	std::atomic<size_t> limit = 0;
+	size_t bytes = 0;
+	uint64_t hits = 0, misses = 0, evictions = 0;
+	std::list<entry> lru; // most recently used first
+	std::unordered_map<uint64_t, std::list<entry>::iterator> index;
+};
@@ -0,0 +1,267 @@
+#include "compress.h"
+#include <stdexcept>
+#include <cstring>
+#include <zlib.h>
+
+#ifdef WITH_ZSTD
+#include <zstd.h>
+#endif
+
+using namespace std;
+
+// Wraps zlib or zstd, with all of the input given up front.
+class decompress_source::decompressor {
+public:
+	decompressor(string_view in) {
+		auto magic = [&](string_view m) {
+			return in.starts_with(m);
+		};
+
+		if (magic("\x1f\x8b") || (in.length() >= 2 && ((uint8_t)in[0] & 0xf) == 8 &&
+								  (((uint8_t)in[0] << 8) | (uint8_t)in[1]) % 31 == 0)) {
+			zs.next_in = (Bytef*)in.data();
+			zs.avail_in = (uInt)in.length();
+
+			// 32 tells zlib to accept either a gzip or a zlib header
+			if (inflateInit2(&zs, MAX_WBITS + 32) != Z_OK)
+				throw runtime_error("inflateInit2 failed.");
+
+			type = format::zlib;
+		} else if (magic("\x28\xb5\x2f\xfd")) {
+#ifdef WITH_ZSTD
+			zds = ZSTD_createDStream();
+
+			if (!zds)
+				throw runtime_error("ZSTD_createDStream failed.");
+
+			zin = {in.data(), in.length(), 0};
+			type = format::zstd;
+#else
+			throw runtime_error("zstd support was not compiled in.");
+#endif
+		} else
+			throw runtime_error("Input is not gzip, zlib, or zstd compressed.");
+	}
+
+	~decompressor() {
+		if (type == format::zlib)
+			inflateEnd(&zs);
+#ifdef WITH_ZSTD
+		else
+			ZSTD_freeDStream(zds);
+#endif
+	}
+
+	// Returns the number of bytes written to buf, which is only less than len
+	// at the end of the stream.
+	size_t decompress(char* buf, size_t len) {
+		if (done)
+			return 0;
+
+		if (type == format::zlib) {
+			zs.next_out = (Bytef*)buf;
+			zs.avail_out = (uInt)len;
+
+			while (zs.avail_out != 0) {
+				auto ret = inflate(&zs, Z_NO_FLUSH);
+
+				if (ret == Z_STREAM_END) {
+					done = true;
+					break;
+				}
+
+				if (ret != Z_OK)
+					throw runtime_error(zs.msg ? zs.msg : "Error decompressing input.");
+			}
+
+			return len - zs.avail_out;
+		}
+
+#ifdef WITH_ZSTD
+		ZSTD_outBuffer out{buf, len, 0};
+
+		while (out.pos < out.size) {
+			auto ret = ZSTD_decompressStream(zds, &out, &zin);
+
+			if (ZSTD_isError(ret))
+				throw runtime_error(ZSTD_getErrorName(ret));
+
+			if (ret == 0 && zin.pos == zin.size) {
+				done = true;
+				break;
+			}
+
+			if (zin.pos == zin.size && out.pos < out.size)
+				throw runtime_error("Truncated zstd input.");
+		}
+
+		return out.pos;
+#else
+		return 0;
+#endif
+	}
+
+	bool done = false;
+
+private:
+	enum class format {
+		zlib,
+		zstd
+	};
+
+	format type;
+	z_stream zs{};
+#ifdef WITH_ZSTD
+	ZSTD_DStream* zds = nullptr;
+	ZSTD_inBuffer zin;
+#endif
+};
+
+decompress_source::decompress_source(string_view in) : d(make_unique<decompressor>(in)) {
+	fill(chunk_size);
+
+	if (pending.starts_with("\xef\xbb\xbf")) // UTF-8 BOM
+		pending.erase(0, 3);
+	else if (pending.starts_with("\xff\xfe")) { // UTF-16 BOM
+		pending.erase(0, 2);
+		is_utf16 = true;
+	} else
+		is_utf16 = pending.length() >= 2 && pending[0] != 0 && pending[1] == 0;
+}
+
+decompress_source::~decompress_source() = default;
+
+// Decompresses into pending until it has target bytes, or the stream's ended.
+void decompress_source::fill(size_t target) {
+	auto old = pending.length();
+
+	if (old >= target)
+		return;
+
+	pending.resize_and_overwrite(target, [&](char* p, size_t n) {
+		return old + d->decompress(p + old, n - old);
+	});
+}
+
+size_t decompress_source::read(char* buf, size_t len) {
+	if (!is_utf16) {
+		auto n = min(pending.length(), len);
+
+		memcpy(buf, pending.data(), n);
+		pending.erase(0, n);
+
+		if (n < len)
+			n += d->decompress(buf + n, len - n);
+
+		return n;
+	}
+
+	// as utf16_source, at most three bytes for each code unit
+	fill((len / 3) * sizeof(char16_t));
+
+	auto units = pending.length() / sizeof(char16_t);
+
+	if (units == 0 && !pending.empty() && d->done)
+		throw runtime_error("UTF-16 input has an odd number of bytes.");
+
+	auto ws = u16string_view((const char16_t*)pending.data(), min(units, len / 3));
+
+	// keep a high surrogate back until we've seen what follows it
+	if (ws.length() > 1 && (ws.length() < units || !d->done) && ws.back() >= 0xd800 && ws.back() <= 0xdbff)
+		ws.remove_suffix(1);
+
+	utf16_source src(ws);
+	auto ret = src.read(buf, len);
+
+	pending.erase(0, ws.length() * sizeof(char16_t));
+
+	return ret;
+}
+
+// Wraps zlib's deflate, appending its output to a string.
+class gzip_writer::compressor {
+public:
+	compressor() {
+		// 16 asks for a gzip header rather than a zlib one. The fastest level is used,
+		// as this is on the query's critical path, and text still shrinks well with it.
+		if (deflateInit2(&zs, Z_BEST_SPEED, Z_DEFLATED, MAX_WBITS + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+			throw runtime_error("deflateInit2 failed.");
+	}
+
+	~compressor() {
+		deflateEnd(&zs);
+	}
+
+	void compress(string_view chunk, bool last) {
+		int ret;
+
+		zs.next_in = (Bytef*)chunk.data();
+		zs.avail_in = (uInt)chunk.length();
+
+		do {
+			auto old = out.length();
+
+			out.resize_and_overwrite(old + input_source::chunk_size, [&](char* p, size_t n) {
+				zs.next_out = (Bytef*)(p + old);
+				zs.avail_out = (uInt)(n - old);
+
+				ret = deflate(&zs, last ? Z_FINISH : Z_NO_FLUSH);
+
+				return n - zs.avail_out;
+			});
+
+			// Z_BUF_ERROR is only harmless when all the input's been taken, and
+			// the last output exactly filled the buffer, leaving nothing to do.
+			if (ret != Z_OK && ret != Z_STREAM_END && (ret != Z_BUF_ERROR || zs.avail_in != 0 || last))
+				throw runtime_error(zs.msg ? zs.msg : "Error compressing output.");
+		} while (zs.avail_out == 0 || zs.avail_in != 0);
+	}
+
+	string out;
+
+private:
+	z_stream zs{};
+};
+
+gzip_writer::gzip_writer(bool utf16) : c(make_unique<compressor>()), utf16(utf16) {
+	buf.reserve(input_source::chunk_size);
+}
+
+gzip_writer::~gzip_writer() = default;
+
+// The length of s up to the end of its last whole UTF-8 sequence.
+static size_t complete_utf8(string_view s) {
+	for (size_t i = 1; i <= min(s.length(), (size_t)3); i++) {
+		auto c = (uint8_t)s[s.length() - i];
+
+		if ((c & 0xc0) == 0x80) // continuation byte
+			continue;
+
+		size_t len = c >= 0xf0 ? 4 : c >= 0xe0 ? 3 : c >= 0xc0 ? 2 : 1;
+
+		return len > i ? s.length() - i : s.length();
+	}
+
+	return s.length();
+}
+
+void gzip_writer::flush(bool last) {
+	if (!utf16) {
+		c->compress(buf, last);
+		buf.clear();
+		return;
+	}
+
+	// a sequence split between chunks is kept back for the next one
+	auto n = last ? buf.length() : complete_utf8(buf);
+	auto ws = utf8_to_utf16(string_view(buf).substr(0, n));
+
+	c->compress(string_view((const char*)ws.data(), ws.length() * sizeof(char16_t)), last);
+	buf.erase(0, n);
+}
+
+string_view gzip_writer::finish() {
+	flush(true);
+
+	return c->out;
+}
@@ -0,0 +1,127 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <memory>
+#include <algorithm>
+#include "jsonfunc.h"
+
+// Decompresses gzip, as from COMPRESS(), or zlib or zstd, a chunk at a time.
+// The text inside can be UTF-16, as it is for NVARCHAR, or UTF-8 - which it is
+// is decided from its first two bytes, as JSON and XML both start with ASCII -
+// and is passed on as UTF-8, so the whole of it never has to be in memory.
+class decompress_source : public input_source {
+public:
+	decompress_source(std::string_view in);
+	~decompress_source();
+
+	size_t read(char* buf, size_t len) override;
+
+	bool utf16() const {
+		return is_utf16;
+	}
+
+private:
+	class decompressor;
+
+	void fill(size_t target);
+
+	std::unique_ptr<decompressor> d;
+	std::string pending; // decompressed, but not yet passed on
+	bool is_utf16 = false;
+};
+
+// Has the same interface as utf8_writer, but gzips what's written to it a
+// chunk at a time, so that DECOMPRESS() can read it, and so that only the
+// compressed output is ever all in memory. If utf16 is set the text is
+// compressed as UTF-16 rather than UTF-8.
+class gzip_writer {
+public:
+	gzip_writer(bool utf16);
+	~gzip_writer();
+
+	gzip_writer(const gzip_writer&) = delete;
+	gzip_writer& operator=(const gzip_writer&) = delete;
+
+	void reserve(size_t) { }
+
+	gzip_writer& operator+=(std::string_view sv) {
+		while (buf.length() + sv.length() > buf.capacity()) {
+			auto n = buf.capacity() - buf.length();
+
+			buf += sv.substr(0, n);
+			sv.remove_prefix(n);
+			flush(false);
+		}
+
+		buf += sv;
+
+		return *this;
+	}
+
+	gzip_writer& operator+=(char c) {
+		if (buf.length() == buf.capacity())
+			flush(false);
+
+		buf += c;
+
+		return *this;
+	}
+
+	void append(size_t count, char c) {
+		while (count > 0) {
+			if (buf.length() == buf.capacity())
+				flush(false);
+
+			auto n = std::min(count, buf.capacity() - buf.length());
+
+			buf.append(n, c);
+			count -= n;
+		}
+	}
+
+	// Compresses what's left, and returns the whole gzip stream.
+	std::string_view finish();
+
+private:
+	class compressor;
+
+	void flush(bool last);
+
+	std::unique_ptr<compressor> c;
+	std::string buf;
+	bool utf16;
+};
+
+enum class compressed_output {
+	utf16,
+	utf8,
+	gzip
+};
+
+// For the _DECOMPRESS and _COMPRESS versions of functions, which take
+// compressed VARBINARY. f reads from the source and writes to the writer, and
+// the result is returned as NVARCHAR, as UTF-8 VARBINARY, or gzipped in the
+// same encoding as the input. The writer is a gzip_writer in the last case, and
+// a utf8_writer otherwise, so f has to take either.
+template<typename F>
+static BSTR from_compressed(const char* in, UINT len, compressed_output out, F&& f) {
+	decompress_source src(std::string_view(in, len));
+
+	if (out == compressed_output::gzip) {
+		gzip_writer s(src.utf16());
+
+		f(src, s);
+
+		return bstr_u8(s.finish());
+	}
+
+	utf8_writer s;
+
+	f(src, s);
+
+	if (out == compressed_output::utf16)
+		return bstr(s.str());
+	else
+		return bstr_u8(s.str());
+}
@@ -0,0 +1,154 @@
+#include "file.h"
+#include "jsonfunc.h"
+#include <stdexcept>
+#include <cstring>
+
+using namespace std;
+
+file_source::file_source(const WCHAR* path) {
+	h = CreateFileW(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+
+	if (h == INVALID_HANDLE_VALUE)
+		throw runtime_error("CreateFileW failed (error " + to_string(GetLastError()) + ").");
+
+	try {
+		fill(chunk_size);
+	} catch (...) {
+		CloseHandle(h);
+		throw;
+	}
+
+	if (pending.starts_with("\xef\xbb\xbf")) // UTF-8 BOM
+		pending.erase(0, 3);
+	else if (pending.starts_with("\xff\xfe")) { // UTF-16 BOM
+		pending.erase(0, 2);
+		is_utf16 = true;
+	}
+}
+
+file_source::~file_source() {
+	CloseHandle(h);
+}
+
+// Returns the number of bytes read into buf, which is only less than len at
+// the end of the file.
+size_t file_source::read_file(char* buf, size_t len) {
+	size_t done = 0;
+
+	while (!eof && done < len) {
+		DWORD n;
+		auto want = (DWORD)min(len - done, (size_t)0x40000000);
+
+		if (!ReadFile(h, buf + done, want, &n, nullptr))
+			throw runtime_error("ReadFile failed (error " + to_string(GetLastError()) + ").");
+
+		if (n == 0)
+			eof = true;
+
+		done += n;
+	}
+
+	return done;
+}
+
+// Reads into pending until it has target bytes, or the file's ended.
+void file_source::fill(size_t target) {
+	auto old = pending.length();
+
+	if (old >= target)
+		return;
+
+	pending.resize_and_overwrite(target, [&](char* p, size_t n) {
+		return old + read_file(p + old, n - old);
+	});
+}
+
+size_t file_source::read(char* buf, size_t len) {
+	if (!is_utf16) {
+		auto n = min(pending.length(), len);
+
+		memcpy(buf, pending.data(), n);
+		pending.erase(0, n);
+
+		if (n < len)
+			n += read_file(buf + n, len - n);
+
+		return n;
+	}
+
+	// as utf16_source, at most three bytes for each code unit
+	fill((len / 3) * sizeof(char16_t));
+
+	auto units = pending.length() / sizeof(char16_t);
+
+	if (units == 0 && !pending.empty() && eof)
+		throw runtime_error("UTF-16 file has an odd number of bytes.");
+
+	auto ws = u16string_view((const char16_t*)pending.data(), min(units, len / 3));
+
+	// keep a high surrogate back until we've seen what follows it
+	if (ws.length() > 1 && (ws.length() < units || !eof) && ws.back() >= 0xd800 && ws.back() <= 0xdbff)
+		ws.remove_suffix(1);
+
+	utf16_source src(ws);
+	auto ret = src.read(buf, len);
+
+	pending.erase(0, ws.length() * sizeof(char16_t));
+
+	return ret;
+}
+
+file_writer::file_writer(const WCHAR* path) : path((const char16_t*)path) {
+	// in the same directory, so that finish() can rename it rather than copy it
+	temp_path = this->path + u".";
+
+	for (auto c : to_string(GetCurrentProcessId()) + "-" + to_string(GetCurrentThreadId())) {
+		temp_path += (char16_t)c;
+	}
+
+	temp_path += u".tmp";
+
+	h = CreateFileW((const WCHAR*)temp_path.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+
+	if (h == INVALID_HANDLE_VALUE)
+		throw runtime_error("CreateFileW failed (error " + to_string(GetLastError()) + ").");
+
+	buf.reserve(input_source::chunk_size);
+}
+
+file_writer::~file_writer() {
+	if (h != INVALID_HANDLE_VALUE)
+		CloseHandle(h);
+
+	if (!finished)
+		DeleteFileW((const WCHAR*)temp_path.c_str());
+}
+
+void file_writer::write(string_view sv) {
+	while (!sv.empty()) {
+		DWORD written;
+		auto n = (DWORD)min(sv.length(), (size_t)0x40000000);
+
+		if (!WriteFile(h, sv.data(), n, &written, nullptr))
+			throw runtime_error("WriteFile failed (error " + to_string(GetLastError()) + ").");
+
+		sv.remove_prefix(written);
+	}
+}
+
+void file_writer::flush() {
+	write(buf);
+	buf.clear();
+}
+
+void file_writer::finish() {
+	flush();
+
+	CloseHandle(h);
+	h = INVALID_HANDLE_VALUE;
+
+	if (!MoveFileExW((const WCHAR*)temp_path.c_str(), (const WCHAR*)path.c_str(), MOVEFILE_REPLACE_EXISTING))
+		throw runtime_error("MoveFileExW failed (error " + to_string(GetLastError()) + ").");
+
+	finished = true;
+}
@@ -0,0 +1,92 @@
+#pragma once
+
+#include <windows.h>
+#include <string>
+#include <string_view>
+#include <algorithm>
+#include "source.h"
+
+// Reads a file a chunk at a time with ReadFile, for the _FILE functions. UTF-16
+// with a BOM is passed on as UTF-8, and a UTF-8 BOM is skipped. An error
+// reading it, e.g. from a network share that's gone away, is thrown as an
+// exception, where a mapped view's would be a structured exception that
+// catch (...) doesn't see.
+class file_source : public input_source {
+public:
+	file_source(const WCHAR* path);
+	~file_source();
+
+	file_source(const file_source&) = delete;
+	file_source& operator=(const file_source&) = delete;
+
+	size_t read(char* buf, size_t len) override;
+
+private:
+	size_t read_file(char* buf, size_t len);
+	void fill(size_t target);
+
+	HANDLE h;
+	std::string pending; // read, but not yet passed on
+	bool is_utf16 = false;
+	bool eof = false;
+};
+
+// Has the same interface as utf8_writer, but writes to a file a chunk at a
+// time, so that output of any size only needs a fixed buffer. It's written
+// under a temporary name in the same directory, and only replaces path in
+// finish(), so if it's destroyed before then, e.g. because an exception was
+// thrown, the partial file is deleted and whatever was at path is untouched.
+class file_writer {
+public:
+	file_writer(const WCHAR* path);
+	~file_writer();
+
+	file_writer(const file_writer&) = delete;
+	file_writer& operator=(const file_writer&) = delete;
+
+	void reserve(size_t) { }
+
+	file_writer& operator+=(std::string_view sv) {
+		if (buf.length() + sv.length() > buf.capacity())
+			flush();
+
+		if (sv.length() > buf.capacity())
+			write(sv);
+		else
+			buf += sv;
+
+		return *this;
+	}
+
+	file_writer& operator+=(char c) {
+		if (buf.length() == buf.capacity())
+			flush();
+
+		buf += c;
+
+		return *this;
+	}
+
+	void append(size_t count, char c) {
+		while (count > 0) {
+			if (buf.length() == buf.capacity())
+				flush();
+
+			auto n = std::min(count, buf.capacity() - buf.length());
+
+			buf.append(n, c);
+			count -= n;
+		}
+	}
+
+	void finish();
+
+private:
+	void flush();
+	void write(std::string_view sv);
+
+	std::u16string path, temp_path;
+	HANDLE h;
+	std::string buf;
+	bool finished = false;
+};
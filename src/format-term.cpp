@@ -9,9 +9,7 @@ typedef struct {
 	string_view text;
 } text_bit;
 
-static string xml_escape(string_view sv) {
-	string s;
-
+static void xml_escape(utf8_writer& s, string_view sv) {
 	for (const auto& c : sv) {
 		if (c == '<')
 			s += "&lt;";
@@ -22,123 +20,139 @@ static string xml_escape(string_view sv) {
 		else
 			s += c;
 	}
-
-	return s;
 }
 
-extern "C" __declspec(dllexport) BSTR TERM2HTML(WCHAR* inw) noexcept {
-	if (!inw)
-		return nullptr;
+static void term2html(string_view in, utf8_writer& s) {
+	bool in_code = false;
+	size_t last_text_start = 0, code_start = 0;
+	text_bit tb;
+	list<text_bit> bits;
+
+	for (size_t i = 0; i < in.size(); i++) {
+		if (!in_code && in[i] == 0x1b && i < in.size() -1 && in[i+1] == '[') {
+			tb.text = in;
+			tb.text = tb.text.substr(last_text_start, i - last_text_start);
+			bits.push_back(tb);
+
+			code_start = i + 2;
+
+			in_code = true;
+			i++;
+			continue;
+		} else if (in_code && ((in[i] >= 'A' && in[i] <= 'Z') || (in[i] >= 'a' && in[i] <= 'z'))) {
+			in_code = false;
+
+			tb.code = in;
+			tb.code = tb.code.substr(code_start, i - code_start + 1);
+			last_text_start = i + 1;
+		}
+	}
 
-	u16string ws;
+	auto it = bits.begin();
+	while (it != bits.end()) {
+		auto it2 = it;
 
-	try {
-		auto in = utf16_to_utf8((char16_t*)inw);
+		it2++;
 
-		bool in_code = false;
-		size_t last_text_start = 0, code_start = 0;
-		text_bit tb;
-		list<text_bit> bits;
+		if (it->text.length() == 0)
+			bits.erase(it);
 
-		for (size_t i = 0; i < in.size(); i++) {
-			if (!in_code && in[i] == 0x1b && i < in.size() -1 && in[i+1] == '[') {
-				tb.text = in;
-				tb.text = tb.text.substr(last_text_start, i - last_text_start);
-				bits.push_back(tb);
+		it = it2;
+	}
 
-				code_start = i + 2;
+	s.reserve(in.length());
 
-				in_code = true;
-				i++;
-				continue;
-			} else if (in_code && ((in[i] >= 'A' && in[i] <= 'Z') || (in[i] >= 'a' && in[i] <= 'z'))) {
-				in_code = false;
+	for (auto& b : bits) {
+		string style;
 
-				tb.code = in;
-				tb.code = tb.code.substr(code_start, i - code_start + 1);
-				last_text_start = i + 1;
-			}
-		}
+		if (b.code.length() >= 1 && b.code.back() == 'm') {
+			size_t st = 0;
+			vector<string_view> codes;
 
-		auto it = bits.begin();
-		while (it != bits.end()) {
-			auto it2 = it;
+			for (size_t i = 0; i < b.code.length() - 1; i++) {
+				if (b.code[i] == ';') {
+					string_view c;
 
-			it2++;
+					c = b.code;
+					c = c.substr(st, i - st);
+					codes.push_back(c);
 
-			if (it->text.length() == 0)
-				bits.erase(it);
+					st = i + 1;
+				}
+			}
 
-			it = it2;
-		}
+			{
+				string_view c;
 
-		string s;
+				c = b.code;
+				c = c.substr(st, b.code.length() - st - 1);
+				codes.push_back(c);
+			}
 
-		for (auto& b : bits) {
-			string style;
+			for (const auto& c : codes) {
+				if (c == "0" || c == "")
+					style += "font-weight:normal;color:auto;";
+				else if (c == "1")
+					style += "font-weight:bold;";
+				else if (c == "30")
+					style += "color:black;";
+				else if (c == "31")
+					style += "color:red;";
+				else if (c == "32")
+					style += "color:green;";
+				else if (c == "33")
+					style += "color:#cccc00;"; // yellow
+				else if (c == "34")
+					style += "color:blue;";
+				else if (c == "35")
+					style += "color:magenta;";
+				else if (c == "36")
+					style += "color:#00cccc;"; // cyan
+				else if (c == "37")
+					style += "color:white;";
+				//else
+					//cerr << "Unhandled display code " << c << "." << endl;
+			}
+		}
 
-			if (b.code.length() >= 1 && b.code.back() == 'm') {
-				size_t st = 0;
-				vector<string_view> codes;
+		if (style != "") {
+			s += "<span style=\"";
+			s += style;
+			s += "\">";
+			xml_escape(s, b.text);
+			s += "</span>";
+		} else
+			xml_escape(s, b.text);
+	}
+}
 
-				for (size_t i = 0; i < b.code.length() - 1; i++) {
-					if (b.code[i] == ';') {
-						string_view c;
+extern "C" __declspec(dllexport) BSTR TERM2HTML(WCHAR* inw) noexcept {
+	if (!inw)
+		return nullptr;
 
-						c = b.code;
-						c = c.substr(st, i - st);
-						codes.push_back(c);
+	try {
+		auto in = utf16_to_utf8((char16_t*)inw);
+		utf8_writer s;
 
-						st = i + 1;
-					}
-				}
+		term2html(in, s);
 
-				{
-					string_view c;
+		return bstr(s.str());
+	} catch (...) {
+		return nullptr;
+	}
+}
 
-					c = b.code;
-					c = c.substr(st, b.code.length() - st - 1);
-					codes.push_back(c);
-				}
+extern "C" __declspec(dllexport) BSTR TERM2HTML_U8(const char* in, UINT len) noexcept {
+	if (!in)
+		return nullptr;
 
-				for (const auto& c : codes) {
-					if (c == "0" || c == "")
-						style += "font-weight:normal;color:auto;";
-					else if (c == "1")
-						style += "font-weight:bold;";
-					else if (c == "30")
-						style += "color:black;";
-					else if (c == "31")
-						style += "color:red;";
-					else if (c == "32")
-						style += "color:green;";
-					else if (c == "33")
-						style += "color:#cccc00;"; // yellow
-					else if (c == "34")
-						style += "color:blue;";
-					else if (c == "35")
-						style += "color:magenta;";
-					else if (c == "36")
-						style += "color:#00cccc;"; // cyan
-					else if (c == "37")
-						style += "color:white;";
-					//else
-						//cerr << "Unhandled display code " << c << "." << endl;
-				}
-			}
+	try {
+		utf8_writer s;
 
-			if (style != "") {
-				s += "<span style=\"" + style + "\">";
-				s += xml_escape(b.text);
-				s += "</span>";
-			} else
-				s += xml_escape(b.text);
-		}
+		term2html(string_view(in, len), s);
 
-		ws = utf8_to_utf16(s);
+		return bstr_u8(s.str());
 	} catch (...) {
 		return nullptr;
 	}
-
-	return bstr(ws);
 }
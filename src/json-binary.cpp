@@ -0,0 +1,324 @@
+#include "jsonfunc.h"
+#include "jsonb.h"
+#include <algorithm>
+#include <limits>
+
+using namespace std;
+
+static constexpr void write_uint(string& s, size_t off, size_t v, size_t width) {
+	for (size_t i = 0; i < width; i++) {
+		s[off + i] = (char)(uint8_t)(v >> (i * 8));
+	}
+}
+
+static constexpr void append_scalar(string& s, jsonb_type t, string_view text) {
+	if (text.length() < 15)
+		s += (char)((uint8_t)t | (text.length() << 4));
+	else {
+		auto len = text.length();
+
+		s += (char)((uint8_t)t | 0xf0);
+
+		while (len >= 0x80) {
+			s += (char)(uint8_t)(0x80 | (len & 0x7f));
+			len >>= 7;
+		}
+
+		s += (char)(uint8_t)len;
+	}
+
+	s += text;
+}
+
+struct jsonb_container {
+	size_t start;
+	vector<size_t> offsets;
+	vector<pair<size_t, size_t>> keys; // where the text of each key is
+};
+
+// Room is left for the largest header when an object or array is opened.
+static constexpr size_t max_header_size = 9;
+
+// Fills in the header of an object or array whose contents have been written,
+// and appends its index.
+static constexpr void close_container(string& s, jsonb_container& c) {
+	auto body = c.start + max_header_size;
+	auto body_len = s.length() - body;
+
+	// sorted by key, and then by where they were
+	if (!c.keys.empty()) {
+		vector<pair<string_view, size_t>> keys;
+		vector<string> decoded;
+
+		keys.reserve(c.keys.size());
+		decoded.reserve(c.keys.size());
+
+		for (size_t i = 0; i < c.keys.size(); i++) {
+			auto k = string_view(s).substr(c.keys[i].first + 1, c.keys[i].second - 2);
+
+			if (k.find('\\') != string::npos) {
+				decoded.push_back(json_enc_string_view{k}.decode());
+				k = decoded.back();
+			}
+
+			keys.emplace_back(k, c.offsets[i]);
+		}
+
+		sort(keys.begin(), keys.end());
+
+		for (size_t i = 0; i < keys.size(); i++) {
+			c.offsets[i] = keys[i].second;
+		}
+	}
+
+	auto count = c.offsets.size();
+	uint8_t width_code = 0;
+
+	// the narrowest width that the size fits in
+	while (width_code < 2 && 1 + (2 << width_code) + body_len + (count << width_code) >= (size_t)1 << (8 << width_code)) {
+		width_code++;
+	}
+
+	size_t width = (size_t)1 << width_code;
+	auto header = 1 + (2 * width);
+	auto size = header + body_len + (count * width);
+
+	if (size > numeric_limits<uint32_t>::max())
+		throw runtime_error("JSON too large to convert to binary.");
+
+	for (auto off : c.offsets) {
+		s.append(width, 0);
+		write_uint(s, s.length() - width, off, width);
+	}
+
+	s.erase(c.start + header, max_header_size - header);
+	s[c.start] = (char)(uint8_t)((uint8_t)s[c.start] | (width_code << 4));
+	write_uint(s, c.start + 1, size, width);
+	write_uint(s, c.start + 1 + width, count, width);
+}
+
+// Converts the JSON that r reads in one pass. The header of each object or array
+// is filled in, and its index added, once its end has been reached - its
+// contents are moved back if its header turns out to be smaller than the room
+// left for it.
+static constexpr void json_to_jsonb(json_reader& r, string& s) {
+	vector<jsonb_container> stack; // kept when they're closed, so that their vectors can be reused
+	size_t depth = 0;
+
+	s += jsonb_magic;
+
+	while (r.read()) {
+		auto t = r.node_type();
+
+		// the index of an object points to its keys, and of an array to its elements
+		if (depth > 0) {
+			auto& c = stack[depth - 1];
+			auto off = s.length() - c.start - max_header_size;
+
+			if (t == json_node::key || ((jsonb_type)s[c.start] == jsonb_type::array && t != json_node::end_array))
+				c.offsets.push_back(off);
+		}
+
+		switch (t) {
+			case json_node::object:
+			case json_node::array:
+				if (depth == stack.size())
+					stack.emplace_back();
+
+				stack[depth].start = s.length();
+				stack[depth].offsets.clear();
+				stack[depth].keys.clear();
+				depth++;
+
+				s += (char)(t == json_node::object ? jsonb_type::object : jsonb_type::array);
+				s.append(max_header_size - 1, 0);
+				break;
+
+			case json_node::end_object:
+			case json_node::end_array:
+				close_container(s, stack[depth - 1]);
+				depth--;
+				break;
+
+			case json_node::key:
+			case json_node::string:
+				append_scalar(s, r.raw().find('\\') == string::npos ? jsonb_type::string : jsonb_type::escaped_string, r.raw());
+
+				if (t == json_node::key)
+					stack[depth - 1].keys.emplace_back(s.length() - r.raw().length(), r.raw().length());
+
+				break;
+
+			case json_node::number:
+				append_scalar(s, jsonb_type::number, r.raw());
+				break;
+
+			case json_node::boolean:
+				append_scalar(s, r.raw() == "true" ? jsonb_type::true_value : jsonb_type::false_value, r.raw());
+				break;
+
+			default:
+				append_scalar(s, jsonb_type::null, r.raw());
+				break;
+		}
+	}
+}
+
+// Also how the document cache stores what it parses.
+string jsonb_from_json(json_reader& r, size_t size_hint) {
+	string s;
+
+	s.reserve(size_hint);
+	json_to_jsonb(r, s);
+
+	return s;
+}
+
+static constexpr string jsonb(string_view in) {
+	json_reader r(in);
+	string s;
+
+	json_to_jsonb(r, s);
+
+	return s;
+}
+
+static constexpr string jsonb_text(string_view in) {
+	jsonb_reader r(in);
+	string s;
+
+	r.read();
+	r.copy(s);
+
+	if (r.read())
+		throw runtime_error("Trailing data after binary JSON.");
+
+	return s;
+}
+
+static_assert(jsonb("1") == "JSB\x01\x13" "1");
+static_assert(jsonb("\"abc\"") == "JSB\x01\x54\"abc\"");
+static_assert(jsonb("[]") == string("JSB\x01\x06\x03\0", 7));
+static_assert(jsonb("[true,null]") == string("JSB\x01\x06\x0f\x02\x42true\x40null\x00\x05", 19));
+static_assert(jsonb("{\"b\":1,\"a\":2}") == string("JSB\x01\x07\x11\x02\x34\"b\"\x13" "1\x34\"a\"\x13" "2\x06\x00", 21));
+static_assert(jsonb("\"0123456789abcdef\"")[4] == '\xf4' && jsonb("\"0123456789abcdef\"")[5] == 18);
+
+// converting back to text gives the same JSON, less its whitespace
+static_assert(jsonb_text(jsonb(" { \"b\" : [ 1 , -2.50e+3 , \"x\\u00e9\" ] , \"a\" : { } , \"a\" : null } ")) ==
+			  "{\"b\":[1,-2.50e+3,\"x\\u00e9\"],\"a\":{},\"a\":null}");
+static_assert(jsonb_text(jsonb("[[[]],{\"\":[false]},\"\"]")) == "[[[]],{\"\":[false]},\"\"]");
+static_assert(jsonb_text(jsonb("\"text\"")) == "\"text\"");
+
+static constexpr string jsonb_member(string_view in, string_view name) {
+	auto b = jsonb(in);
+	jsonb_reader r(b);
+
+	r.read();
+
+	auto [lo, hi] = r.find(name);
+	string s;
+
+	for (auto i = lo; i < hi; i++) {
+		r.seek(i);
+		r.read();
+		r.copy(s);
+	}
+
+	return s;
+}
+
+static_assert(jsonb_member("{\"c\":1,\"a\":2,\"b\":3,\"a\":4}", "a") == "24");
+static_assert(jsonb_member("{\"c\":1,\"a\":2,\"b\":3,\"a\":4}", "c") == "1");
+static_assert(jsonb_member("{\"c\":1,\"a\":2,\"b\":[5,6]}", "b") == "[5,6]");
+static_assert(jsonb_member("{\"c\":1,\"a\":2}", "d") == "");
+static_assert(jsonb_member("{}", "") == "");
+
+// As with the version for json_reader, but with the member found through the
+// index, and the rest of the element jumped over.
+bool select_member(jsonb_reader& r, string& key, string& value) {
+	switch (r.node_type()) {
+		case json_node::object: {
+			if (key.empty() && r.size() != 0)
+				key = r.key(0);
+
+			auto [lo, hi] = r.find(key);
+
+			if (lo == hi) {
+				r.seek_end();
+				r.read();
+				return false;
+			}
+
+			// where a key is duplicated, the last value wins
+			r.seek(hi - 1);
+			r.read();
+			value.clear();
+			r.copy(value);
+			r.seek_end();
+			r.read();
+
+			return true;
+		}
+
+		case json_node::array:
+			// the "key" of the first item in an array is its index
+			if (key.empty() && r.size() != 0)
+				key = "0";
+
+			r.skip();
+			return false;
+
+		default:
+			return false;
+	}
+}
+
+extern "C" __declspec(dllexport) BSTR JSON_BINARY(WCHAR* in) noexcept {
+	if (!in)
+		return nullptr;
+
+	try {
+		u16string_view inw = (char16_t*)in;
+		utf16_source src(inw);
+		json_reader r(src);
+
+		return bstr_u8(jsonb_from_json(r, inw.length()));
+	} catch (...) {
+		return nullptr;
+	}
+}
+
+extern "C" __declspec(dllexport) BSTR JSON_BINARY_U8(const char* in, UINT len) noexcept {
+	if (!in)
+		return nullptr;
+
+	try {
+		json_reader r(string_view(in, len));
+
+		return bstr_u8(jsonb_from_json(r, len));
+	} catch (...) {
+		return nullptr;
+	}
+}
+
+extern "C" __declspec(dllexport) BSTR JSON_TEXT(const char* in, UINT len) noexcept {
+	if (!in)
+		return nullptr;
+
+	try {
+		return bstr(jsonb_text(string_view(in, len)));
+	} catch (...) {
+		return nullptr;
+	}
+}
+
+extern "C" __declspec(dllexport) BSTR JSON_TEXT_U8(const char* in, UINT len) noexcept {
+	if (!in)
+		return nullptr;
+
+	try {
+		return bstr_u8(jsonb_text(string_view(in, len)));
+	} catch (...) {
+		return nullptr;
+	}
+}
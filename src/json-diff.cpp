@@ -0,0 +1,672 @@
+#include "jsonfunc.h"
+#include "json.h"
+#include <algorithm>
+#include <nlohmann/json.hpp>
+
+using namespace std;
+
+// A value of a document, in a flat array in document order, where each object
+// or array is followed by its members or elements.
+struct diff_node {
+	json_node type;
+	string_view key; // as in the JSON, less its quotes, if it's a member of an object
+	string_view text; // as in the JSON, including all of an object or array
+	size_t next; // the node after this one and everything in it
+	uint64_t hash;
+};
+
+static constexpr uint64_t hash_mul = 0x9e3779b97f4a7c15;
+
+static constexpr uint64_t mix(uint64_t h) {
+	h ^= h >> 31;
+	h *= 0xbf58476d1ce4e5b9;
+	h ^= h >> 29;
+
+	return h;
+}
+
+// Eight bytes at a time, for the text of strings and numbers.
+static constexpr uint64_t hash_text(string_view s, uint64_t h) {
+	h = (h ^ s.length()) * hash_mul;
+
+	while (s.length() >= 8) {
+		uint64_t w = 0;
+
+		for (unsigned int i = 0; i < 8; i++) {
+			w |= (uint64_t)(uint8_t)s[i] << (i * 8);
+		}
+
+		h = mix((h ^ w) * hash_mul);
+		s.remove_prefix(8);
+	}
+
+	for (auto c : s) {
+		h = (h ^ (uint8_t)c) * hash_mul;
+	}
+
+	return mix(h);
+}
+
+// Escapes don't matter to whether keys or strings are the same.
+static constexpr uint64_t hash_string(json_enc_string_view sv, uint64_t h) {
+	if (sv.raw().find('\\') == string::npos)
+		return hash_text(sv.raw(), h);
+
+	return hash_text(sv.decode(), h);
+}
+
+// Builds the nodes for a document, and hashes each value from its contents:
+// arrays from their elements in order, and objects from their members in any
+// order. Two values with the same hash are taken to be the same without being
+// compared.
+static constexpr vector<diff_node> diff_tree(string_view sv) {
+	json_reader r(sv);
+	vector<diff_node> nodes;
+	vector<size_t> stack;
+	string_view key;
+
+	// a guess, to save most of the reallocations - values are rarely shorter
+	nodes.reserve(sv.length() / 16);
+
+	while (r.read()) {
+		switch (r.node_type()) {
+			case json_node::key:
+				key = r.string_value().raw();
+				continue;
+
+			case json_node::end_object:
+			case json_node::end_array: {
+				auto& n = nodes[stack.back()];
+				uint64_t h = 0;
+				size_t count = 0;
+
+				n.text = string_view(n.text.data(), (size_t)(r.raw().data() + 1 - n.text.data()));
+				n.next = nodes.size();
+
+				for (auto i = stack.back() + 1; i < n.next; i = nodes[i].next) {
+					if (n.type == json_node::object)
+						h += mix(hash_string(nodes[i].key, hash_mul) ^ nodes[i].hash);
+					else
+						h = mix((h ^ nodes[i].hash) * hash_mul);
+
+					count++;
+				}
+
+				n.hash = mix((h ^ count) * hash_mul + (uint64_t)n.type);
+				stack.pop_back();
+				break;
+			}
+
+			default: {
+				auto t = r.node_type();
+				auto in_object = !stack.empty() && nodes[stack.back()].type == json_node::object;
+
+				nodes.push_back({t, in_object ? key : string_view{}, r.raw(), nodes.size() + 1, 0});
+
+				if (t == json_node::object || t == json_node::array)
+					stack.push_back(nodes.size() - 1);
+				else if (t == json_node::string)
+					nodes.back().hash = hash_string(r.string_value(), (uint64_t)t);
+				else
+					nodes.back().hash = hash_text(r.raw(), (uint64_t)t);
+
+				break;
+			}
+		}
+	}
+
+	return nodes;
+}
+
+// Writes s as a JSON string.
+static constexpr void write_string(utf8_writer& out, string_view s) {
+	constexpr string_view hex = "0123456789abcdef";
+
+	out += '"';
+
+	for (auto c : s) {
+		switch (c) {
+			case '"':
+				out += "\\\"";
+				break;
+
+			case '\\':
+				out += "\\\\";
+				break;
+
+			case '\n':
+				out += "\\n";
+				break;
+
+			case '\r':
+				out += "\\r";
+				break;
+
+			case '\t':
+				out += "\\t";
+				break;
+
+			default:
+				if ((uint8_t)c < 0x20) {
+					out += "\\u00";
+					out += hex[(uint8_t)c >> 4];
+					out += hex[(uint8_t)c & 0xf];
+				} else
+					out += c;
+		}
+	}
+
+	out += '"';
+}
+
+// beyond which arrays are diffed element by element, rather than spending
+// ever more time on lining them up
+static constexpr ptrdiff_t max_edits = 256;
+
+// Produces an RFC 6902 patch that turns a into b. Only the values whose hashes
+// differ are looked into, so an unchanged branch costs no more than comparing
+// its hash. What's left to do is kept on a stack, rather than by recursing,
+// so that there's no limit to how deeply the documents can be nested.
+class json_differ {
+public:
+	constexpr json_differ(const vector<diff_node>& a, const vector<diff_node>& b, utf8_writer& out) :
+		a(a), b(b), out(out) { }
+
+	constexpr void run() {
+		out += '[';
+
+		if (!a.empty() && !b.empty())
+			diff(0, 0);
+
+		while (!tasks.empty()) {
+			auto t = tasks.back();
+
+			tasks.pop_back();
+			path.resize(t.len);
+
+			if (t.key)
+				push_key(t.key->key);
+			else
+				push(t.index);
+
+			switch (t.type) {
+				case task_type::diff:
+					diff(t.i, t.j);
+					break;
+
+				case task_type::remove:
+					op("remove", nullptr);
+					break;
+
+				case task_type::add:
+					op("add", &b[t.j]);
+					break;
+			}
+		}
+
+		out += ']';
+	}
+
+private:
+	enum class task_type {
+		diff,
+		remove,
+		add
+	};
+
+	// A diff or op for a member or element, whose path is that of its parent,
+	// whose length is len, plus the key of the node key, or else index.
+	struct task {
+		task_type type;
+		size_t i, j;
+		size_t len;
+		const diff_node* key;
+		size_t index;
+	};
+
+	constexpr void op(string_view name, const diff_node* value) {
+		if (!first)
+			out += ',';
+
+		out += "{\"op\":\"";
+		out += name;
+		out += "\",\"path\":";
+		write_string(out, path);
+
+		if (value) {
+			string s;
+			json_reader r(value->text);
+
+			r.read();
+			r.copy(s);
+
+			out += ",\"value\":";
+			out += s;
+		}
+
+		out += '}';
+		first = false;
+	}
+
+	// JSON Pointer escapes ~ and /, as ~0 and ~1
+	constexpr void push(string_view token) {
+		path += '/';
+
+		for (auto c : token) {
+			if (c == '~')
+				path += "~0";
+			else if (c == '/')
+				path += "~1";
+			else
+				path += c;
+		}
+	}
+
+	constexpr void push_key(string_view raw) {
+		if (raw.find('\\') == string::npos)
+			push(raw);
+		else
+			push(json_enc_string_view{raw}.decode());
+	}
+
+	constexpr void push(size_t index) {
+		auto len = path.length();
+
+		path += '/';
+
+		do {
+			path.insert(path.begin() + (ptrdiff_t)len + 1, (char)('0' + (index % 10)));
+			index /= 10;
+		} while (index != 0);
+	}
+
+	// the members of an object, sorted by key and with duplicates left out, as
+	// the last one is the one that counts
+	static constexpr vector<pair<string_view, size_t>> members(const vector<diff_node>& nodes, size_t n,
+															   vector<string>& decoded) {
+		vector<pair<string_view, size_t>> ret;
+		size_t count = 0;
+
+		for (auto i = n + 1; i < nodes[n].next; i = nodes[i].next) {
+			count++;
+		}
+
+		ret.reserve(count);
+		decoded.reserve(count);
+
+		for (auto i = n + 1; i < nodes[n].next; i = nodes[i].next) {
+			auto k = nodes[i].key;
+
+			if (k.find('\\') != string::npos) {
+				decoded.push_back(json_enc_string_view{k}.decode());
+				k = decoded.back();
+			}
+
+			ret.emplace_back(k, i);
+		}
+
+		sort(ret.begin(), ret.end());
+
+		auto last = unique(ret.rbegin(), ret.rend(), [](const auto& x, const auto& y) {
+			return x.first == y.first;
+		});
+
+		ret.erase(ret.begin(), last.base());
+
+		return ret;
+	}
+
+	constexpr void diff_object(size_t i, size_t j) {
+		vector<string> ad, bd;
+		auto am = members(a, i, ad);
+		auto bm = members(b, j, bd);
+		auto len = path.length();
+		auto bi = bm.begin();
+		auto first_task = tasks.size();
+
+		for (const auto& [k, n] : am) {
+			while (bi != bm.end() && bi->first < k) {
+				bi++;
+			}
+
+			if (bi == bm.end() || bi->first != k)
+				tasks.push_back({task_type::remove, n, 0, len, &a[n], 0});
+			else if (a[n].hash != b[bi->second].hash)
+				tasks.push_back({task_type::diff, n, bi->second, len, &a[n], 0});
+		}
+
+		vector<size_t> added;
+		auto ai = am.begin();
+
+		for (const auto& [k, n] : bm) {
+			while (ai != am.end() && ai->first < k) {
+				ai++;
+			}
+
+			if (ai == am.end() || ai->first != k)
+				added.push_back(n);
+		}
+
+		// added in the order they're in in b, as that's the order they'll end up in
+		sort(added.begin(), added.end());
+
+		for (auto n : added) {
+			tasks.push_back({task_type::add, 0, n, len, &b[n], 0});
+		}
+
+		// the last to be done goes on first
+		reverse(tasks.begin() + (ptrdiff_t)first_task, tasks.end());
+	}
+
+	enum class edit {
+		same,
+		remove,
+		add
+	};
+
+	// The shortest run of removals and additions that turns the elements ae into
+	// be, comparing them by their hashes, by Myers' algorithm - which takes time
+	// in proportion to the number of elements times the number of edits. Returns
+	// false if there'd be more than max_edits of them.
+	constexpr bool shortest_edit(const vector<size_t>& ae, const vector<size_t>& be, vector<edit>& edits) {
+		auto n = (ptrdiff_t)ae.size(), m = (ptrdiff_t)be.size();
+		vector<ptrdiff_t> v((size_t)(2 * max_edits + 3)), trace;
+		ptrdiff_t d;
+
+		// v[k] is how far along ae the furthest path on diagonal k (x - y) has got
+		auto at = [](vector<ptrdiff_t>& v, ptrdiff_t k) -> ptrdiff_t& {
+			return v[(size_t)(k + max_edits + 1)];
+		};
+
+		// the v of each step, for -d <= k <= d, starting at d * d
+		auto traced = [&](ptrdiff_t d, ptrdiff_t k) {
+			return trace[(size_t)((d * d) + k + d)];
+		};
+
+		for (d = 0; ; d++) {
+			if (d > max_edits)
+				return false;
+
+			bool done = false;
+
+			for (auto k = -d; k <= d; k += 2) {
+				ptrdiff_t x;
+
+				if (k == -d || (k != d && at(v, k - 1) < at(v, k + 1)))
+					x = at(v, k + 1);
+				else
+					x = at(v, k - 1) + 1;
+
+				auto y = x - k;
+
+				while (x < n && y < m && a[ae[(size_t)x]].hash == b[be[(size_t)y]].hash) {
+					x++;
+					y++;
+				}
+
+				at(v, k) = x;
+
+				if (x >= n && y >= m)
+					done = true;
+			}
+
+			for (auto k = -d; k <= d; k++) {
+				trace.push_back(at(v, k));
+			}
+
+			if (done)
+				break;
+		}
+
+		// followed back from the end
+		auto x = n, y = m;
+
+		for (; d > 0; d--) {
+			auto k = x - y;
+			auto added = k == -d || (k != d && traced(d - 1, k - 1) < traced(d - 1, k + 1));
+			auto prev_x = traced(d - 1, added ? k + 1 : k - 1);
+			auto prev_y = prev_x - (added ? k + 1 : k - 1);
+
+			while (x > prev_x && y > prev_y) {
+				edits.push_back(edit::same);
+				x--;
+				y--;
+			}
+
+			edits.push_back(added ? edit::add : edit::remove);
+			x = prev_x;
+			y = prev_y;
+		}
+
+		while (x > 0) {
+			edits.push_back(edit::same);
+			x--;
+		}
+
+		reverse(edits.begin(), edits.end());
+
+		return true;
+	}
+
+	// Elements are lined up by their hashes, so that an insertion or deletion
+	// doesn't show up as a change to everything after it. Where elements have
+	// been both removed and added in the same place, they're diffed pairwise
+	// instead, so that a change within an element shows up as just that.
+	constexpr void diff_array(size_t i, size_t j) {
+		vector<size_t> ae, be;
+		vector<edit> edits;
+		auto len = path.length();
+		auto first_task = tasks.size();
+
+		for (auto n = i + 1; n < a[i].next; n = a[n].next) {
+			ae.push_back(n);
+		}
+
+		for (auto n = j + 1; n < b[j].next; n = b[n].next) {
+			be.push_back(n);
+		}
+
+		// if they're too different, just compare elements with the same index
+		if (!shortest_edit(ae, be, edits)) {
+			edits.clear();
+
+			for (size_t k = 0; k < max(ae.size(), be.size()); k++) {
+				if (k < ae.size() && k < be.size()) {
+					edits.push_back(edit::remove);
+					edits.push_back(edit::add);
+				} else
+					edits.push_back(k < ae.size() ? edit::remove : edit::add);
+			}
+		}
+
+		// x and y are where we are in ae and be, and y is also the index in the
+		// array as it will be, as everything before it has been patched
+		size_t x = 0, y = 0, e = 0;
+
+		while (e < edits.size()) {
+			if (edits[e] == edit::same) {
+				x++;
+				y++;
+				e++;
+				continue;
+			}
+
+			size_t removed = 0, added = 0;
+
+			for (; e < edits.size() && edits[e] != edit::same; e++) {
+				if (edits[e] == edit::remove)
+					removed++;
+				else
+					added++;
+			}
+
+			for (; removed > 0 && added > 0; removed--, added--) {
+				if (a[ae[x]].hash != b[be[y]].hash)
+					tasks.push_back({task_type::diff, ae[x], be[y], len, nullptr, y});
+
+				x++;
+				y++;
+			}
+
+			for (; removed > 0; removed--) {
+				tasks.push_back({task_type::remove, ae[x], 0, len, nullptr, y});
+				x++;
+			}
+
+			for (; added > 0; added--) {
+				tasks.push_back({task_type::add, 0, be[y], len, nullptr, y});
+				y++;
+			}
+		}
+
+		reverse(tasks.begin() + (ptrdiff_t)first_task, tasks.end());
+	}
+
+	constexpr void diff(size_t i, size_t j) {
+		if (a[i].hash == b[j].hash)
+			return;
+
+		if (a[i].type != b[j].type || (a[i].type != json_node::object && a[i].type != json_node::array))
+			op("replace", &b[j]);
+		else if (a[i].type == json_node::object)
+			diff_object(i, j);
+		else
+			diff_array(i, j);
+	}
+
+	const vector<diff_node>& a;
+	const vector<diff_node>& b;
+	utf8_writer& out;
+	string path;
+	vector<task> tasks;
+	bool first = true;
+};
+
+static constexpr void json_diff(string_view a, string_view b, utf8_writer& out) {
+	auto ta = diff_tree(a);
+	auto tb = diff_tree(b);
+
+	json_differ(ta, tb, out).run();
+}
+
+static constexpr string json_diff(string_view a, string_view b) {
+	utf8_writer out;
+
+	json_diff(a, b, out);
+
+	return string{out.str()};
+}
+
+static_assert(json_diff("{\"a\":1}", "{ \"a\" : 1 }") == "[]");
+static_assert(json_diff("{\"a\":1,\"b\":2}", "{\"b\":2,\"a\":1}") == "[]");
+static_assert(json_diff("{\"a\":1}", "{\"a\":2}") == R"([{"op":"replace","path":"/a","value":2}])");
+static_assert(json_diff("{\"a\":1,\"b\":[1, 2]}", "{\"c\":{ \"d\" : null },\"b\":[1,2],\"a0\":0}") ==
+			  R"([{"op":"remove","path":"/a"},{"op":"add","path":"/c","value":{"d":null}},{"op":"add","path":"/a0","value":0}])");
+static_assert(json_diff("[1,2,3,4]", "[1,5,2,3,4]") == R"([{"op":"add","path":"/1","value":5}])");
+static_assert(json_diff("[1,2,3,4]", "[1,4]") == R"([{"op":"remove","path":"/1"},{"op":"remove","path":"/1"}])");
+static_assert(json_diff("[0,1,2,3,4,5]", "[1,2,[3],4]") ==
+			  R"([{"op":"remove","path":"/0"},{"op":"replace","path":"/2","value":[3]},{"op":"remove","path":"/4"}])");
+static_assert(json_diff("[1,{\"a\":1,\"b\":2},3]", "[0,1,{\"b\":2,\"a\":1},3,4]") ==
+			  R"([{"op":"add","path":"/0","value":0},{"op":"add","path":"/4","value":4}])");
+static_assert(json_diff("[1,{\"x\":[true]},3]", "[1,{\"x\":[false]},3]") ==
+			  R"([{"op":"replace","path":"/1/x/0","value":false}])");
+static_assert(json_diff("{\"a/b\":{\"c~d\":1}}", "{\"a/b\":{\"c~d\":\"x\"}}") ==
+			  R"([{"op":"replace","path":"/a~1b/c~0d","value":"x"}])");
+static_assert(json_diff("{\"a\":1,\"a\":2}", "{\"a\":2}") == "[]");
+static_assert(json_diff("1", "[1]") == R"([{"op":"replace","path":"","value":[1]}])");
+static_assert(json_diff("{}", "[]") == R"([{"op":"replace","path":"","value":[]}])");
+static_assert(json_diff("{\"a\":[[1,{\"b\":[2]}]],\"c\":1}", "{\"a\":[[1,{\"b\":[3]}]],\"c\":2,\"d\":0}") ==
+			  R"([{"op":"replace","path":"/a/0/1/b/0","value":3},{"op":"replace","path":"/c","value":2},{"op":"add","path":"/d","value":0}])");
+
+extern "C" __declspec(dllexport) BSTR JSON_DIFF(WCHAR* aw, WCHAR* bw) noexcept {
+	if (!aw || !bw)
+		return nullptr;
+
+	try {
+		auto a = utf16_to_utf8((char16_t*)aw);
+		auto b = utf16_to_utf8((char16_t*)bw);
+		utf8_writer out;
+
+		json_diff(a, b, out);
+
+		return bstr(out.str());
+	} catch (...) {
+		return nullptr;
+	}
+}
+
+extern "C" __declspec(dllexport) BSTR JSON_DIFF_U8(const char* a, UINT alen, const char* b, UINT blen) noexcept {
+	if (!a || !b)
+		return nullptr;
+
+	try {
+		utf8_writer out;
+
+		json_diff(string_view(a, alen), string_view(b, blen), out);
+
+		return bstr_u8(out.str());
+	} catch (...) {
+		return nullptr;
+	}
+}
+
+// Patches are applied to a DOM, keeping members in the order they were in.
+using ordered_json = nlohmann::ordered_json;
+
+static string json_patch(string_view doc, string_view patch) {
+	return ordered_json::parse(doc).patch(ordered_json::parse(patch)).dump();
+}
+
+static string json_merge_patch(string_view doc, string_view patch) {
+	auto j = ordered_json::parse(doc);
+
+	j.merge_patch(ordered_json::parse(patch));
+
+	return j.dump();
+}
+
+// Applies an RFC 6902 patch, e.g. from JSON_DIFF.
+extern "C" __declspec(dllexport) BSTR JSON_PATCH(WCHAR* doc, WCHAR* patch) noexcept {
+	if (!doc || !patch)
+		return nullptr;
+
+	try {
+		return bstr(json_patch(utf16_to_utf8((char16_t*)doc), utf16_to_utf8((char16_t*)patch)));
+	} catch (...) {
+		return nullptr;
+	}
+}
+
+extern "C" __declspec(dllexport) BSTR JSON_PATCH_U8(const char* doc, UINT doclen, const char* patch, UINT patchlen) noexcept {
+	if (!doc || !patch)
+		return nullptr;
+
+	try {
+		return bstr_u8(json_patch(string_view(doc, doclen), string_view(patch, patchlen)));
+	} catch (...) {
+		return nullptr;
+	}
+}
+
+// Applies an RFC 7396 merge patch.
+extern "C" __declspec(dllexport) BSTR JSON_MERGE_PATCH(WCHAR* doc, WCHAR* patch) noexcept {
+	if (!doc || !patch)
+		return nullptr;
+
+	try {
+		return bstr(json_merge_patch(utf16_to_utf8((char16_t*)doc), utf16_to_utf8((char16_t*)patch)));
+	} catch (...) {
+		return nullptr;
+	}
+}
+
+extern "C" __declspec(dllexport) BSTR JSON_MERGE_PATCH_U8(const char* doc, UINT doclen, const char* patch, UINT patchlen) noexcept {
+	if (!doc || !patch)
+		return nullptr;
+
+	try {
+		return bstr_u8(json_merge_patch(string_view(doc, doclen), string_view(patch, patchlen)));
+	} catch (...) {
+		return nullptr;
+	}
+}
@@ -0,0 +1,60 @@
+#include "jsonfunc.h"
+#include "json.h"
+#include "json-hash.h"
+#include <array>
+
+using namespace std;
+
+static_assert(canonical_hash("{\"a\":1,\"b\":[true,null,\"x\"]}") == canonical_hash(" { \"b\" : [ true , null , \"x\" ] , \"a\" : 1 } "));
+static_assert(canonical_hash("{\"a\":{\"c\":1,\"d\":2},\"b\":3}") == canonical_hash("{\"b\":3,\"a\":{\"d\":2,\"c\":1}}"));
+static_assert(canonical_hash("[1,2]") != canonical_hash("[2,1]"));
+static_assert(canonical_hash("{\"a\":1,\"b\":2}") != canonical_hash("{\"a\":2,\"b\":1}"));
+static_assert(canonical_hash("{\"a\":1}") != canonical_hash("{\"a\":1,\"a\":1}"));
+static_assert(canonical_hash("[[]]") != canonical_hash("[]") && canonical_hash("{}") != canonical_hash("[]"));
+static_assert(canonical_hash("\"1\"") != canonical_hash("1") && canonical_hash("null") != canonical_hash("false"));
+static_assert(canonical_hash("[\"a\",\"b\"]") != canonical_hash("[\"ab\"]"));
+static_assert(canonical_hash("1") == canonical_hash("1.0") && canonical_hash("1") == canonical_hash("10e-1") && canonical_hash("1") == canonical_hash("0.1E+1"));
+static_assert(canonical_hash("-120") == canonical_hash("-1.2e2") && canonical_hash("0.00012") == canonical_hash("12e-5"));
+static_assert(canonical_hash("0") == canonical_hash("-0.0e5") && canonical_hash("0") != canonical_hash("1"));
+static_assert(canonical_hash("1") != canonical_hash("-1") && canonical_hash("12") != canonical_hash("1.2") && canonical_hash("101") != canonical_hash("11"));
+static_assert(canonical_hash("1000000000000000000000001") != canonical_hash("1e24"));
+static_assert(canonical_hash("\"\\u0041\\n\"") == canonical_hash("\"A\\u000a\"") && canonical_hash("\"\\ud83d\\ude00\"") == canonical_hash("\"\xf0\x9f\x98\x80\""));
+
+static BSTR hash_bstr(const json_hash& h) noexcept {
+	array<char, 16> buf;
+
+	for (unsigned int i = 0; i < 8; i++) {
+		buf[i] = (char)(uint8_t)(h.lo >> (i * 8));
+		buf[8 + i] = (char)(uint8_t)(h.hi >> (i * 8));
+	}
+
+	return bstr_u8(string_view(buf.data(), buf.size()));
+}
+
+// Both return the hash as 16 bytes, i.e. as BINARY(16).
+extern "C" __declspec(dllexport) BSTR JSON_HASH(WCHAR* in) noexcept {
+	if (!in)
+		return nullptr;
+
+	try {
+		utf16_source src((char16_t*)in);
+		json_reader r(src);
+
+		return hash_bstr(canonical_hasher::hash(r));
+	} catch (...) {
+		return nullptr;
+	}
+}
+
+extern "C" __declspec(dllexport) BSTR JSON_HASH_U8(const char* in, UINT len) noexcept {
+	if (!in)
+		return nullptr;
+
+	try {
+		json_reader r(string_view(in, len));
+
+		return hash_bstr(canonical_hasher::hash(r));
+	} catch (...) {
+		return nullptr;
+	}
+}
@@ -0,0 +1,300 @@
+#pragma once
+
+#include "json.h"
+#include <algorithm>
+#include <array>
+
+// json_hash is a 128-bit hash of a document as it would be with its whitespace
+// removed, the members of each object sorted by key, and its numbers and
+// strings written in one way only - but worked out as it's read, without any of
+// that text being produced. It's for telling documents apart, not for security.
+class canonical_hasher {
+public:
+	// Hashes what r reads. Arrays fold their elements in in order. Objects add
+	// up the hashes of their members, which is the same whatever order they're
+	// in - and so the same as if they'd been sorted.
+	template<typename R>
+	static constexpr json_hash hash(R& r) {
+		struct frame {
+			bool object;
+			json_hash acc;
+			json_hash key;
+			uint64_t count;
+		};
+
+		std::vector<frame> stack;
+		json_hash ret{};
+
+		while (r.read()) {
+			json_hash v;
+
+			switch (r.node_type()) {
+				case json_node::key:
+					stack.back().key = hash_string(r.string_value(), hash_tag::member);
+					continue;
+
+				case json_node::object:
+				case json_node::array:
+					stack.push_back({r.node_type() == json_node::object, {}, {}, 0});
+					continue;
+
+				case json_node::end_object:
+				case json_node::end_array: {
+					auto& f = stack.back();
+					auto tag = (uint64_t)(f.object ? hash_tag::object : hash_tag::array);
+
+					v = combine(combine({k1 ^ tag, k2 + tag}, f.acc), {f.count, f.count});
+					stack.pop_back();
+					break;
+				}
+
+				case json_node::string:
+					v = hash_string(r.string_value(), hash_tag::string);
+					break;
+
+				case json_node::number:
+					v = hash_number(r.raw());
+					break;
+
+				case json_node::boolean:
+					v = hash_writer((uint8_t)(r.raw() == "true" ? hash_tag::true_value : hash_tag::false_value)).finish();
+					break;
+
+				default:
+					v = hash_writer((uint8_t)hash_tag::null).finish();
+					break;
+			}
+
+			if (stack.empty())
+				ret = v;
+			else {
+				auto& f = stack.back();
+
+				if (f.object) {
+					auto m = fold(f.key, v);
+
+					f.acc.lo += m.lo;
+					f.acc.hi += m.hi;
+				} else
+					f.acc = fold(f.acc, v);
+
+				f.count++;
+			}
+		}
+
+		return ret;
+	}
+
+private:
+	static constexpr uint64_t k1 = 0x9e3779b97f4a7c15;
+	static constexpr uint64_t k2 = 0xc2b2ae3d27d4eb4f;
+
+	// from MurmurHash3
+	static constexpr uint64_t fmix(uint64_t h) {
+		h ^= h >> 33;
+		h *= 0xff51afd7ed558ccd;
+		h ^= h >> 33;
+		h *= 0xc4ceb9fe1a85ec53;
+		h ^= h >> 33;
+
+		return h;
+	}
+
+	static constexpr uint64_t rotl(uint64_t v, int n) {
+		return (v << n) | (v >> (64 - n));
+	}
+
+	// Folds v into h, in a way that depends on the order things are folded in.
+	static constexpr json_hash combine(json_hash h, json_hash v) {
+		return {fmix(((h.lo ^ v.lo) * k1) + v.hi), fmix(((h.hi ^ v.hi) * k2) + v.lo)};
+	}
+
+	// As combine, but cheaper and weaker, for each element or member of an object
+	// or array - whose hash is then put through combine when it's closed.
+	static constexpr json_hash fold(json_hash h, json_hash v) {
+		return {rotl(h.lo ^ v.lo, 23) * k1, (rotl(h.hi ^ v.hi, 29) + v.lo) * k2};
+	}
+
+	class hash_writer {
+	public:
+		constexpr hash_writer(uint8_t tag) : h{k1 ^ tag, k2 + tag} { }
+
+		constexpr void append(std::string_view s) {
+			len += s.length();
+
+			if (buf_len != 0) {
+				while (buf_len < 8 && !s.empty()) {
+					buf[buf_len++] = s.front();
+					s.remove_prefix(1);
+				}
+
+				if (buf_len < 8)
+					return;
+
+				word(std::string_view(buf.data(), 8));
+				buf_len = 0;
+			}
+
+			while (s.length() >= 8) {
+				word(s.substr(0, 8));
+				s.remove_prefix(8);
+			}
+
+			for (auto c : s) {
+				buf[buf_len++] = c;
+			}
+		}
+
+		constexpr void append(char c) {
+			len++;
+			buf[buf_len++] = c;
+
+			if (buf_len == 8) {
+				word(std::string_view(buf.data(), 8));
+				buf_len = 0;
+			}
+		}
+
+		constexpr json_hash finish() {
+			uint64_t w = 0;
+
+			for (size_t i = 0; i < buf_len; i++) {
+				w |= (uint64_t)(uint8_t)buf[i] << (i * 8);
+			}
+
+			// only lightly mixed, as it'll be combined into its parent
+			h.lo = (h.lo ^ w ^ len) * k1;
+			h.hi = ((h.hi ^ w) * k2) + h.lo;
+
+			return {h.lo ^ (h.lo >> 32), h.hi ^ (h.hi >> 29)};
+		}
+
+	private:
+		constexpr void word(std::string_view s) {
+			uint64_t w = 0;
+
+			for (unsigned int i = 0; i < 8; i++) {
+				w |= (uint64_t)(uint8_t)s[i] << (i * 8);
+			}
+
+			h.lo = rotl(h.lo ^ w, 31) * k1;
+			h.hi = (rotl(h.hi ^ w, 27) + h.lo) * k2;
+		}
+
+		json_hash h;
+		std::array<char, 8> buf{};
+		size_t buf_len = 0;
+		size_t len = 0;
+	};
+
+	enum class hash_tag : uint8_t {
+		null = 1,
+		false_value,
+		true_value,
+		number,
+		string,
+		array,
+		object,
+		member
+	};
+
+	// Numbers are hashed as their significant digits and their exponent, so that
+	// e.g. 1, 1.0, 10e-1 and 0.1E+1 are all the same. Exponents beyond what fits in
+	// an int64_t are clamped, so very large ones may collide.
+	static constexpr json_hash hash_number(std::string_view s) {
+		hash_writer w((uint8_t)hash_tag::number);
+		bool neg = false;
+		int64_t exp = 0;
+
+		if (s.front() == '-') {
+			neg = true;
+			s.remove_prefix(1);
+		}
+
+		size_t dot = s.length(), e = s.length();
+
+		for (size_t i = 0; i < s.length(); i++) {
+			if (s[i] == '.')
+				dot = i;
+			else if (s[i] == 'e' || s[i] == 'E') {
+				e = i;
+				break;
+			}
+		}
+
+		auto int_part = s.substr(0, std::min(dot, e));
+		auto frac = dot < e ? s.substr(dot + 1, e - dot - 1) : std::string_view{};
+
+		if (e < s.length()) {
+			bool exp_neg = false;
+			int64_t v = 0;
+
+			s.remove_prefix(e + 1);
+
+			if (s.front() == '+' || s.front() == '-') {
+				exp_neg = s.front() == '-';
+				s.remove_prefix(1);
+			}
+
+			for (auto c : s) {
+				if (v < 1'000'000'000'000'000)
+					v = (v * 10) + (c - '0');
+			}
+
+			exp = exp_neg ? -v : v;
+		}
+
+		exp -= (int64_t)frac.length();
+
+		// The digits are those of the two parts run together, less any zeroes at
+		// either end. Only an integer part of 0 can start with a zero.
+		if (int_part == "0") {
+			int_part = {};
+			frac.remove_prefix(std::min(frac.find_first_not_of('0'), frac.length()));
+		}
+
+		auto trailing = frac.length() - std::min(frac.find_last_not_of('0') + 1, frac.length());
+
+		frac.remove_suffix(trailing);
+		exp += (int64_t)trailing;
+
+		if (frac.empty()) {
+			trailing = int_part.length() - std::min(int_part.find_last_not_of('0') + 1, int_part.length());
+			int_part.remove_suffix(trailing);
+			exp += (int64_t)trailing;
+		}
+
+		// zero has no sign and no exponent
+		if (int_part.empty() && frac.empty())
+			return w.finish();
+
+		if (neg)
+			w.append('-');
+
+		w.append(int_part);
+		w.append(frac);
+
+		auto h = w.finish();
+
+		h.hi += (uint64_t)exp * k1;
+
+		return h;
+	}
+
+	static constexpr json_hash hash_string(json_enc_string_view sv, hash_tag tag) {
+		hash_writer w((uint8_t)tag);
+
+		if (sv.raw().find('\\') == std::string_view::npos)
+			w.append(sv.raw());
+		else
+			w.append(sv.decode());
+
+		return w.finish();
+	}
+};
+
+constexpr json_hash canonical_hash(std::string_view sv) {
+	json_reader r(sv);
+
+	return canonical_hasher::hash(r);
+}
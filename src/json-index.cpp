@@ -0,0 +1,570 @@
+#include "jsonfunc.h"
+#include <stdexcept>
+#include <bit>
+#include <algorithm>
+#include <array>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define USE_SSE2
+#endif
+
+using namespace std;
+
+// A 64-byte block of input, classified with one bit per byte.
+struct json_block {
+	uint64_t backslash = 0;
+	uint64_t quote = 0;
+	uint64_t whitespace = 0;
+	uint64_t op = 0; // {}[]:,
+	uint64_t control = 0; // including tabs and newlines, which aren't allowed in strings
+};
+
+#ifdef USE_SSE2
+static json_block classify_sse2(const char* p) noexcept {
+	json_block b;
+
+	for (unsigned int i = 0; i < 4; i++) {
+		auto v = _mm_loadu_si128((const __m128i*)(p + (i * 16)));
+		auto lower = _mm_or_si128(v, _mm_set1_epi8(0x20)); // [ and ] to { and }
+
+		auto eq = [](__m128i v, char c) {
+			return _mm_cmpeq_epi8(v, _mm_set1_epi8(c));
+		};
+
+		auto bits = [&](__m128i m) {
+			return (uint64_t)(uint16_t)_mm_movemask_epi8(m) << (i * 16);
+		};
+
+		b.backslash |= bits(eq(v, '\\'));
+		b.quote |= bits(eq(v, '"'));
+		b.whitespace |= bits(_mm_or_si128(_mm_or_si128(eq(v, ' '), eq(v, '\t')),
+										  _mm_or_si128(eq(v, '\r'), eq(v, '\n'))));
+		b.op |= bits(_mm_or_si128(_mm_or_si128(eq(lower, '{'), eq(lower, '}')),
+								  _mm_or_si128(eq(v, ':'), eq(v, ','))));
+		b.control |= bits(_mm_and_si128(_mm_cmplt_epi8(v, _mm_set1_epi8(0x20)),
+										_mm_cmpgt_epi8(v, _mm_set1_epi8(-1))));
+	}
+
+	return b;
+}
+#endif
+
+static constexpr json_block classify(const char* p) {
+#ifdef USE_SSE2
+	if (!is_constant_evaluated())
+		return classify_sse2(p);
+#endif
+
+	json_block b;
+
+	for (unsigned int i = 0; i < 64; i++) {
+		auto bit = (uint64_t)1 << i;
+
+		switch (p[i]) {
+			case '\\':
+				b.backslash |= bit;
+				break;
+
+			case '"':
+				b.quote |= bit;
+				break;
+
+			case '\t':
+			case '\r':
+			case '\n':
+				b.control |= bit;
+				[[fallthrough]];
+
+			case ' ':
+				b.whitespace |= bit;
+				break;
+
+			case '{':
+			case '}':
+			case '[':
+			case ']':
+			case ':':
+			case ',':
+				b.op |= bit;
+				break;
+
+			default:
+				if ((uint8_t)p[i] < 0x20)
+					b.control |= bit;
+				break;
+		}
+	}
+
+	return b;
+}
+
+// Returns the characters that follow an odd number of backslashes. carry is
+// set if the block ends halfway through such a run.
+static constexpr uint64_t escaped_chars(uint64_t backslash, uint64_t& carry) {
+	constexpr uint64_t even_bits = 0x5555555555555555;
+
+	auto escaped = carry;
+
+	backslash &= ~escaped;
+
+	auto follows_escape = (backslash << 1) | escaped;
+	auto odd_starts = backslash & ~even_bits & ~follows_escape;
+	auto even_starts = odd_starts + backslash;
+
+	carry = even_starts < backslash ? 1 : 0;
+
+	return (even_bits ^ (even_starts << 1)) & follows_escape;
+}
+
+// Bit i of the result is the XOR of bits 0 to i.
+static constexpr uint64_t prefix_xor(uint64_t x) {
+	x ^= x << 1;
+	x ^= x << 2;
+	x ^= x << 4;
+	x ^= x << 8;
+	x ^= x << 16;
+	x ^= x << 32;
+
+	return x;
+}
+
+static_assert(prefix_xor(0b1001000) == 0b0111000);
+
+static constexpr int hex_digit(char c) {
+	if (c >= '0' && c <= '9')
+		return c - '0';
+	else if (c >= 'a' && c <= 'f')
+		return c - 'a' + 10;
+	else if (c >= 'A' && c <= 'F')
+		return c - 'A' + 10;
+	else
+		return -1;
+}
+
+// Returns the code unit of the \u escape whose u is at pos, or -1 if it's invalid.
+static constexpr int escaped_code_unit(string_view sv, size_t pos) {
+	int cp = 0;
+
+	if (pos + 4 >= sv.length())
+		return -1;
+
+	for (size_t i = pos + 1; i <= pos + 4; i++) {
+		auto v = hex_digit(sv[i]);
+
+		if (v == -1)
+			return -1;
+
+		cp = (cp << 4) | v;
+	}
+
+	return cp;
+}
+
+static constexpr bool is_digit(char c) {
+	return c >= '0' && c <= '9';
+}
+
+// the characters that can follow a number or literal
+static constexpr auto delimiters = []() {
+	array<bool, 256> t{};
+
+	for (auto c : " \t\r\n{}[]:,\""sv) {
+		t[(uint8_t)c] = true;
+	}
+
+	return t;
+}();
+
+// Returns the length of the literal or number at the start of sv, or 0 if there isn't one.
+static constexpr size_t scalar_length(string_view sv) {
+	size_t i = 0;
+
+	switch (sv.front()) {
+		case 't':
+			return sv.starts_with("true") ? 4 : 0;
+
+		case 'f':
+			return sv.starts_with("false") ? 5 : 0;
+
+		case 'n':
+			return sv.starts_with("null") ? 4 : 0;
+	}
+
+	auto digits = [&]() {
+		auto start = i;
+
+		while (i < sv.length() && is_digit(sv[i])) {
+			i++;
+		}
+
+		return i > start;
+	};
+
+	if (i < sv.length() && sv[i] == '-')
+		i++;
+
+	if (i < sv.length() && sv[i] == '0')
+		i++;
+	else if (!digits())
+		return 0;
+
+	if (i < sv.length() && sv[i] == '.') {
+		i++;
+
+		if (!digits())
+			return 0;
+	}
+
+	if (i < sv.length() && (sv[i] == 'e' || sv[i] == 'E')) {
+		i++;
+
+		if (i < sv.length() && (sv[i] == '+' || sv[i] == '-'))
+			i++;
+
+		if (!digits())
+			return 0;
+	}
+
+	return i;
+}
+
+enum class scan_state : uint8_t {
+	value,
+	first_value,
+	first_key,
+	key,
+	colon,
+	comma_object,
+	comma_array,
+	done
+};
+
+enum class scan_action : uint8_t {
+	error,
+	open_object,
+	open_array,
+	close,
+	value,
+	scalar,
+	key,
+	colon,
+	comma_object,
+	comma_array
+};
+
+// '{', '[', '}', ']', ':', ',', '"', or anything else, which starts a number or literal
+static constexpr auto char_classes = []() {
+	array<uint8_t, 256> t{};
+
+	t.fill(7);
+
+	for (uint8_t i = 0; auto c : "{[}]:,\""sv) {
+		t[(uint8_t)c] = i++;
+	}
+
+	return t;
+}();
+
+// the grammar of JSON, as what each structural character does in each state
+static constexpr auto transitions = []() {
+	using enum scan_action;
+
+	array<array<scan_action, 8>, 8> t{};
+
+	t[(size_t)scan_state::value] = { open_object, open_array, error, error, error, error, value, scalar };
+	t[(size_t)scan_state::first_value] = { open_object, open_array, error, close, error, error, value, scalar };
+	t[(size_t)scan_state::first_key] = { error, error, close, error, error, error, key, error };
+	t[(size_t)scan_state::key] = { error, error, error, error, error, error, key, error };
+	t[(size_t)scan_state::colon] = { error, error, error, error, colon, error, error, error };
+	t[(size_t)scan_state::comma_object] = { error, error, close, error, error, comma_object, error, error };
+	t[(size_t)scan_state::comma_array] = { error, error, error, close, error, comma_array, error, error };
+
+	return t;
+}();
+
+// The two stages of simdjson, run together a block at a time: the bitmasks
+// find the structural characters, i.e. the operators, the quotes that open
+// strings and the first characters of literals and numbers, and then these are
+// checked against the grammar. Whitespace, the contents of strings and the rest
+// of each literal are never looked at one byte at a time. If out isn't null,
+// everything except the whitespace between tokens is copied to it, in runs -
+// it needs room for sv.length() bytes. Returns the number of bytes written, or
+// npos if the JSON isn't valid. UTF-8 isn't validated here - see valid_utf8.
+static constexpr size_t json_scan(string_view sv, char* out) {
+	auto state = scan_state::value;
+	vector<scan_state> stack(64); // comma_object or comma_array for each open container
+	size_t depth = 0;
+	uint64_t escape_carry = 0, in_string_carry = 0, other_carry = 0;
+	size_t low_surrogate = string::npos, written = 0;
+
+	auto structural = [&](size_t pos) {
+		auto c = sv[pos];
+
+		switch (transitions[(size_t)state][char_classes[(uint8_t)c]]) {
+			case scan_action::error:
+				return false;
+
+			case scan_action::open_object:
+			case scan_action::open_array:
+				// quicker than push_back
+				if (depth == stack.size())
+					stack.resize(depth * 2);
+
+				stack[depth] = c == '{' ? scan_state::comma_object : scan_state::comma_array;
+				state = c == '{' ? scan_state::first_key : scan_state::first_value;
+				depth++;
+				return true;
+
+			case scan_action::close:
+				depth--;
+				break;
+
+			case scan_action::value:
+				break;
+
+			case scan_action::scalar: {
+				auto len = scalar_length(sv.substr(pos));
+
+				if (len == 0)
+					return false;
+
+				// the number or literal has to be all of the run, e.g. not 1.2.3 or truex
+				if (pos + len < sv.length() && !delimiters[(uint8_t)sv[pos + len]])
+					return false;
+
+				break;
+			}
+
+			case scan_action::key:
+				state = scan_state::colon;
+				return true;
+
+			case scan_action::colon:
+			case scan_action::comma_array:
+				state = scan_state::value;
+				return true;
+
+			case scan_action::comma_object:
+				state = scan_state::key;
+				return true;
+		}
+
+		state = depth == 0 ? scan_state::done : stack[depth - 1];
+
+		return true;
+	};
+
+	auto escape = [&](size_t pos) {
+		switch (sv[pos]) {
+			case '"':
+			case '\\':
+			case '/':
+			case 'b':
+			case 'f':
+			case 'n':
+			case 'r':
+			case 't':
+				return true;
+
+			case 'u': {
+				auto cp = escaped_code_unit(sv, pos);
+
+				if (cp == -1)
+					return false;
+
+				if (cp >= 0xdc00 && cp <= 0xdfff)
+					return pos == low_surrogate;
+
+				if (cp >= 0xd800 && cp <= 0xdbff) {
+					if (pos + 6 >= sv.length() || sv[pos + 5] != '\\' || sv[pos + 6] != 'u')
+						return false;
+
+					cp = escaped_code_unit(sv, pos + 6);
+
+					if (cp < 0xdc00 || cp > 0xdfff)
+						return false;
+
+					low_surrogate = pos + 6;
+				}
+
+				return true;
+			}
+
+			default:
+				return false;
+		}
+	};
+
+	for (size_t start = 0; start < sv.length(); start += 64) {
+		char tail[64] = {};
+		auto p = sv.data() + start;
+		auto len = min(sv.length() - start, (size_t)64);
+
+		// pad the last block with spaces
+		if (len < 64) {
+			for (size_t i = 0; i < 64; i++) {
+				tail[i] = i < len ? p[i] : ' ';
+			}
+
+			p = tail;
+		}
+
+		auto b = classify(p);
+		auto escaped = escaped_chars(b.backslash, escape_carry);
+		auto quote = b.quote & ~escaped;
+
+		// includes the opening quote but not the closing one
+		auto in_string = prefix_xor(quote) ^ in_string_carry;
+
+		in_string_carry = (in_string >> 63) ? ~(uint64_t)0 : 0;
+
+		if (b.control & in_string)
+			return string::npos;
+
+		for (auto e = escaped & in_string; e != 0; e &= e - 1) {
+			if (!escape(start + (size_t)countr_zero(e)))
+				return string::npos;
+		}
+
+		auto other = ~(b.whitespace | b.op | quote | in_string);
+		auto starts = (b.op & ~in_string) | (quote & in_string) | (other & ~((other << 1) | other_carry));
+
+		other_carry = other >> 63;
+
+		for (; starts != 0; starts &= starts - 1) {
+			if (!structural(start + (size_t)countr_zero(starts)))
+				return string::npos;
+		}
+
+		if (out) {
+			auto keep = ~(b.whitespace & ~in_string);
+
+			if (len < 64)
+				keep &= ((uint64_t)1 << len) - 1;
+
+			while (keep != 0) {
+				auto from = (unsigned int)countr_zero(keep);
+				auto run = (unsigned int)countr_one(keep >> from);
+
+				copy_n(sv.data() + start + from, run, out + written);
+				written += run;
+
+				keep = from + run == 64 ? 0 : keep & ~(((uint64_t)1 << (from + run)) - 1);
+			}
+		}
+	}
+
+	if (state != scan_state::done || in_string_carry != 0)
+		return string::npos;
+
+	return written;
+}
+
+static constexpr bool json_valid(string_view sv) {
+	return json_scan(sv, nullptr) != string::npos;
+}
+
+// Returns an empty string if sv isn't valid.
+static constexpr string json_minify(string_view sv) {
+	string s;
+
+	s.resize_and_overwrite(sv.length(), [&](char* out, size_t) {
+		auto len = json_scan(sv, out);
+
+		return len == string::npos ? 0 : len;
+	});
+
+	return s;
+}
+
+static_assert(json_valid("{}"));
+static_assert(json_valid(" [1, -2.5e+3, true, false, null, \"a\\\"b\", {\"c\": [] } ] "));
+static_assert(json_valid("\"\\ud83d\\ude00\""));
+static_assert(json_valid("0"));
+static_assert(!json_valid(""));
+static_assert(!json_valid("["));
+static_assert(!json_valid("[1,]"));
+static_assert(!json_valid("{\"a\" 1}"));
+static_assert(!json_valid("{\"a\":1]"));
+static_assert(!json_valid("[01]"));
+static_assert(!json_valid("[1.]"));
+static_assert(!json_valid("[tru]"));
+static_assert(!json_valid("[truex]"));
+static_assert(!json_valid("[1 2]"));
+static_assert(!json_valid("[\"a\"1]"));
+static_assert(!json_valid("\"abc"));
+static_assert(!json_valid("\"a\tb\""));
+static_assert(!json_valid("\"\\x\""));
+static_assert(!json_valid("\"\\ud83d\""));
+static_assert(!json_valid("\"\\ude00\""));
+static_assert(!json_valid("\"\\ud83d\\\\ude00\""));
+static_assert(!json_valid("{} {}"));
+static_assert(json_valid("[\"" + string(100, 'x') + "\\\\\",\"" + string(100, ' ') + "\"]"));
+
+static_assert(json_minify(" { \"a b\" : [ 1 , 2 ] ,\n\t\"c\" : \"\\\" x \" } ") == "{\"a b\":[1,2],\"c\":\"\\\" x \"}");
+static_assert(json_minify(string(70, ' ') + "[ \"" + string(70, ' ') + "\" ]" + string(70, '\n')) == "[\"" + string(70, ' ') + "\"]");
+static_assert(json_minify("[1,2") == "");
+
+extern "C" __declspec(dllexport) BOOL JSON_VALID(WCHAR* in) noexcept {
+	if (!in)
+		return FALSE;
+
+	try {
+		return json_valid(utf16_to_utf8((char16_t*)in)) ? TRUE : FALSE;
+	} catch (...) {
+		return FALSE;
+	}
+}
+
+extern "C" __declspec(dllexport) BOOL JSON_VALID_U8(const char* in, UINT len) noexcept {
+	if (!in)
+		return FALSE;
+
+	try {
+		string_view sv(in, len);
+
+		return json_valid(sv) && valid_utf8(sv) ? TRUE : FALSE;
+	} catch (...) {
+		return FALSE;
+	}
+}
+
+extern "C" __declspec(dllexport) BSTR JSON_MINIFY(WCHAR* in) noexcept {
+	if (!in)
+		return nullptr;
+
+	try {
+		auto s = utf16_to_utf8((char16_t*)in);
+		auto len = json_scan(s, s.data()); // the output's never ahead of the input
+
+		if (len == string::npos)
+			return nullptr;
+
+		return bstr(string_view(s).substr(0, len));
+	} catch (...) {
+		return nullptr;
+	}
+}
+
+extern "C" __declspec(dllexport) BSTR JSON_MINIFY_U8(const char* in, UINT len) noexcept {
+	if (!in)
+		return nullptr;
+
+	try {
+		string_view sv(in, len);
+
+		if (!valid_utf8(sv))
+			return nullptr;
+
+		auto s = json_minify(sv);
+
+		if (s.empty())
+			return nullptr;
+
+		return bstr_u8(s);
+	} catch (...) {
+		return nullptr;
+	}
+}
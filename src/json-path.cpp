@@ -0,0 +1,106 @@
+#include "json.h"
+#include <charconv>
+
+using namespace std;
+
+// Parses a path in the syntax JSON_VALUE uses, e.g. $.a.b[0]."key with spaces".
+json_path parse_json_path(string_view sv) {
+	json_path path;
+
+	if (sv.empty() || sv.front() != '$')
+		throw runtime_error("JSON path must start with $.");
+
+	sv.remove_prefix(1);
+
+	while (!sv.empty()) {
+		if (sv.front() == '.') {
+			sv.remove_prefix(1);
+
+			if (!sv.empty() && sv.front() == '"') {
+				size_t end = 1;
+
+				while (end < sv.length() && sv[end] != '"') {
+					if (sv[end] == '\\')
+						end++;
+
+					end++;
+				}
+
+				if (end >= sv.length())
+					throw runtime_error("Unterminated key in JSON path.");
+
+				path.push_back({json_enc_string_view{sv.substr(1, end - 1)}.decode(), nullopt});
+				sv.remove_prefix(end + 1);
+			} else {
+				auto name = sv.substr(0, sv.find_first_of(".["));
+
+				if (name.empty())
+					throw runtime_error("Empty key in JSON path.");
+
+				path.push_back({string{name}, nullopt});
+				sv.remove_prefix(name.length());
+			}
+		} else if (sv.front() == '[') {
+			auto end = sv.find(']');
+			size_t index;
+
+			if (end == string::npos)
+				throw runtime_error("Unterminated index in JSON path.");
+
+			auto [ptr, ec] = from_chars(sv.data() + 1, sv.data() + end, index);
+
+			if (ec != errc{} || ptr != sv.data() + end)
+				throw runtime_error("Invalid index in JSON path.");
+
+			path.push_back({"", index});
+			sv.remove_prefix(end + 1);
+		} else
+			throw runtime_error("Malformed JSON path.");
+	}
+
+	return path;
+}
+
+// Leaves r on the value that path points to, or returns false if there isn't
+// one. Everything else is skipped over without being decoded, and nothing
+// after the value is read.
+bool find_path(json_reader& r, const json_path& path) {
+	if (!r.read())
+		return false;
+
+	for (const auto& step : path) {
+		bool found = false;
+
+		if (step.index) {
+			if (r.node_type() != json_node::array)
+				return false;
+
+			for (size_t i = 0; r.read() && r.node_type() != json_node::end_array; i++) {
+				if (i == *step.index) {
+					found = true;
+					break;
+				}
+
+				r.skip();
+			}
+		} else {
+			if (r.node_type() != json_node::object)
+				return false;
+
+			while (r.read() && r.node_type() == json_node::key) {
+				if (r.string_value().cmp(step.name)) {
+					r.read();
+					found = true;
+					break;
+				}
+
+				r.skip();
+			}
+		}
+
+		if (!found)
+			return false;
+	}
+
+	return true;
+}
@@ -0,0 +1,63 @@
+#include "json.h"
+#include <algorithm>
+
+using namespace std;
+
+bool select_member(json_reader& r, string& key, string& value) {
+	bool found = false;
+
+	switch (r.node_type()) {
+		case json_node::object:
+			// Objects used to be std::maps, so the key picked is the first one
+			// in sorted order. Where a key is duplicated, the last value wins.
+			if (key.empty()) {
+				string first_key;
+
+				while (r.read() && r.node_type() == json_node::key) {
+					auto k = r.string_value().decode();
+
+					if (!found || k <= first_key) {
+						first_key = k;
+						value.clear();
+						r.copy(value);
+						found = true;
+					} else
+						r.skip();
+				}
+
+				key = first_key;
+			} else {
+				while (r.read() && r.node_type() == json_node::key) {
+					if (r.string_value().cmp(key)) {
+						value.clear();
+						r.copy(value);
+						found = true;
+					} else
+						r.skip();
+				}
+			}
+
+			break;
+
+		case json_node::array: {
+			auto d = r.depth();
+
+			r.read();
+
+			// the "key" of the first item in an array is its index
+			if (r.depth() >= d && key.empty())
+				key = "0";
+
+			while (r.depth() >= d) {
+				r.read();
+			}
+
+			break;
+		}
+
+		default:
+			break;
+	}
+
+	return found;
+}
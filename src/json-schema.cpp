@@ -0,0 +1,1395 @@
+#include "jsonfunc.h"
+#include "json.h"
+#include "json-hash.h"
+#include "regex.h"
+#include <algorithm>
+#include <charconv>
+#include <limits>
+#include <memory>
+#include <type_traits>
+
+using namespace std;
+
+enum schema_type : uint8_t {
+	type_null = 1,
+	type_boolean = 2,
+	type_object = 4,
+	type_array = 8,
+	type_number = 16,
+	type_integer = 32,
+	type_string = 64
+};
+
+static constexpr string_view type_names[] = {"null", "boolean", "object", "array", "number", "integer", "string"};
+
+// A subschema, with the keywords it has. Other subschemas are referred to by
+// their index in compiled_schema::nodes.
+struct schema_node {
+	bool never = false; // the schema false
+	uint8_t types = 0; // bits of schema_type, or 0 for anything
+
+	optional<double> minimum, maximum, exclusive_minimum, exclusive_maximum, multiple_of;
+	optional<size_t> min_length, max_length;
+	optional<schema_regex> pattern;
+
+	optional<size_t> min_items, max_items;
+	vector<size_t> prefix_items;
+	optional<size_t> items; // for those after prefix_items
+	optional<size_t> contains;
+	bool unique_items = false;
+
+	optional<size_t> min_properties, max_properties;
+	vector<pair<string, size_t>> properties; // sorted by name
+	vector<pair<schema_regex, size_t>> pattern_properties;
+	optional<size_t> additional_properties;
+	vector<string> required; // sorted
+	optional<size_t> property_names;
+
+	vector<json_hash> enum_values;
+	optional<json_hash> const_value;
+
+	// Applied to the whole value, which means reading it more than once.
+	optional<size_t> ref;
+	bool alias = false; // nothing but ref
+	vector<size_t> all_of, any_of, one_of;
+	optional<size_t> not_schema, if_schema, then_schema, else_schema;
+
+	constexpr bool has_applicators() const {
+		return ref || !all_of.empty() || !any_of.empty() || !one_of.empty() || not_schema || if_schema;
+	}
+
+	constexpr bool has_object_keywords() const {
+		return min_properties || max_properties || !properties.empty() || !pattern_properties.empty() ||
+			additional_properties || !required.empty() || property_names;
+	}
+
+	constexpr bool has_array_keywords() const {
+		return min_items || max_items || !prefix_items.empty() || items || contains || unique_items;
+	}
+};
+
+// The text of the schema, read into a tree so that its keywords can be looked
+// up in any order, and $refs followed. Where an object has a key more than
+// once, the last one wins.
+struct schema_json {
+	constexpr schema_json(json_reader& r, unsigned int depth);
+
+	constexpr const schema_json* find(string_view k) const {
+		auto it = find_if(children.begin(), children.end(), [&](const auto& c) {
+			return c.key == k;
+		});
+
+		return it == children.end() ? nullptr : &*it;
+	}
+
+	constexpr const schema_json& at(string_view pointer) const;
+
+	constexpr string get_string() const {
+		return json_enc_string_view{text.substr(1, text.length() - 2)}.decode();
+	}
+
+	json_node type;
+	string_view text; // all of the value, as in the JSON
+	string key; // if it's an object member
+	vector<schema_json> children;
+};
+
+// far more than any real schema, but a limit on how far compiling recurses
+static constexpr unsigned int max_schema_depth = 256;
+
+constexpr schema_json::schema_json(json_reader& r, unsigned int depth) : type(r.node_type()), text(r.raw()) {
+	if (type != json_node::object && type != json_node::array)
+		return;
+
+	if (depth == max_schema_depth)
+		throw runtime_error("Schema is nested too deeply.");
+
+	auto start = r.raw().data();
+
+	while (r.read() && r.node_type() != json_node::end_object && r.node_type() != json_node::end_array) {
+		string k;
+
+		if (r.node_type() == json_node::key) {
+			k = r.string_value().decode();
+			r.read();
+		}
+
+		schema_json v(r, depth + 1);
+
+		v.key = move(k);
+
+		if (type == json_node::object) {
+			auto it = find_if(children.begin(), children.end(), [&](const auto& c) {
+				return c.key == v.key;
+			});
+
+			if (it != children.end()) {
+				*it = move(v);
+				continue;
+			}
+		}
+
+		children.push_back(move(v));
+	}
+
+	text = string_view(start, (size_t)(r.raw().data() + r.raw().length() - start));
+}
+
+// Follows a JSON pointer, e.g. /properties/a~1b/items/0.
+constexpr const schema_json& schema_json::at(string_view pointer) const {
+	auto v = this;
+	auto p = pointer;
+
+	while (v && !p.empty()) {
+		if (p.front() != '/')
+			throw runtime_error("Invalid reference #" + string{pointer} + ".");
+
+		p.remove_prefix(1);
+
+		auto token = p.substr(0, p.find('/'));
+		string name;
+
+		p.remove_prefix(token.length());
+
+		for (size_t i = 0; i < token.length(); i++) {
+			if (token[i] == '~' && i + 1 < token.length() && (token[i + 1] == '0' || token[i + 1] == '1')) {
+				name += token[i + 1] == '0' ? '~' : '/';
+				i++;
+			} else
+				name += token[i];
+		}
+
+		if (v->type == json_node::object)
+			v = v->find(name);
+		else if (v->type == json_node::array && !name.empty() && name.length() < 10 &&
+				 all_of(name.begin(), name.end(), [](char c) { return c >= '0' && c <= '9'; })) {
+			size_t idx = 0;
+
+			for (auto c : name) {
+				idx = (idx * 10) + (size_t)(c - '0');
+			}
+
+			v = idx < v->children.size() ? &v->children[idx] : nullptr;
+		} else
+			v = nullptr;
+	}
+
+	if (!v)
+		throw runtime_error("Reference #" + string{pointer} + " not found.");
+
+	return *v;
+}
+
+// from_chars isn't constexpr, so while compiling this only works out an
+// approximation, which is all the static_asserts need.
+static constexpr double to_double(string_view raw) {
+	double d = 0;
+
+	if (!is_constant_evaluated()) {
+		if (from_chars(raw.data(), raw.data() + raw.length(), d).ec == errc::result_out_of_range) {
+			if (raw.find("e-") != string::npos || raw.find("E-") != string::npos)
+				d = 0;
+			else
+				d = raw.front() == '-' ? -numeric_limits<double>::infinity() : numeric_limits<double>::infinity();
+		}
+
+		return d;
+	}
+
+	auto neg = raw.starts_with("-");
+	int64_t exp = 0;
+	bool frac = false;
+
+	if (neg)
+		raw.remove_prefix(1);
+
+	while (!raw.empty() && raw.front() != 'e' && raw.front() != 'E') {
+		if (raw.front() == '.')
+			frac = true;
+		else {
+			d = (d * 10) + (raw.front() - '0');
+
+			if (frac)
+				exp--;
+		}
+
+		raw.remove_prefix(1);
+	}
+
+	if (!raw.empty()) {
+		raw.remove_prefix(1);
+
+		auto exp_neg = raw.starts_with("-");
+		int64_t v = 0;
+
+		if (raw.starts_with("-") || raw.starts_with("+"))
+			raw.remove_prefix(1);
+
+		for (auto c : raw) {
+			if (v < 100000)
+				v = (v * 10) + (c - '0');
+		}
+
+		exp += exp_neg ? -v : v;
+	}
+
+	for (; exp > 0 && d - d == 0; exp--) {
+		d *= 10;
+	}
+
+	for (; exp < 0 && d != 0; exp++) {
+		d /= 10;
+	}
+
+	return neg ? -d : d;
+}
+
+// std::isfinite, std::floor and the like aren't constexpr in MSVC.
+
+static constexpr bool is_finite(double d) {
+	return d - d == 0;
+}
+
+static constexpr double magnitude(double d) {
+	return d < 0 ? -d : d;
+}
+
+// beyond 2^53, every double is a whole number
+static constexpr double nearest_whole(double d) {
+	if (magnitude(d) >= 9007199254740992.0)
+		return d;
+
+	return (double)(int64_t)(d < 0 ? d - 0.5 : d + 0.5);
+}
+
+static constexpr void append_json_string(string& s, string_view v) {
+	constexpr string_view hex = "0123456789abcdef";
+
+	s += '"';
+
+	for (auto c : v) {
+		switch (c) {
+			case '"':
+				s += "\\\"";
+				break;
+
+			case '\\':
+				s += "\\\\";
+				break;
+
+			case '\n':
+				s += "\\n";
+				break;
+
+			case '\r':
+				s += "\\r";
+				break;
+
+			case '\t':
+				s += "\\t";
+				break;
+
+			default:
+				if ((uint8_t)c < 0x20) {
+					s += "\\u00";
+					s += hex[(uint8_t)c >> 4];
+					s += hex[(uint8_t)c & 0xf];
+				} else
+					s += c;
+		}
+	}
+
+	s += '"';
+}
+
+static constexpr void append_number(string& s, size_t n) {
+	auto len = s.length();
+
+	do {
+		s.insert(s.begin() + (ptrdiff_t)len, (char)('0' + (n % 10)));
+		n /= 10;
+	} while (n != 0);
+}
+
+// A schema compiled into an array of nodes, the first being the root. Only
+// references within the schema itself, i.e. those starting with #, are
+// supported, and format is treated as an annotation.
+class compiled_schema {
+public:
+	constexpr compiled_schema(string_view text);
+
+	constexpr optional<string> validate(json_reader& r, unsigned int max_depth) const;
+
+	vector<schema_node> nodes;
+
+private:
+	constexpr size_t compile(const schema_json& j, const string& pointer);
+	constexpr size_t compile_child(const schema_json& j, const string& pointer, string_view key);
+
+	vector<pair<string, size_t>> compiled; // by JSON pointer
+	vector<pair<size_t, string>> refs; // to be resolved once everything else has been compiled
+};
+
+static constexpr string escape_pointer(string_view s) {
+	string ret;
+
+	for (auto c : s) {
+		if (c == '~')
+			ret += "~0";
+		else if (c == '/')
+			ret += "~1";
+		else
+			ret += c;
+	}
+
+	return ret;
+}
+
+constexpr compiled_schema::compiled_schema(string_view text) {
+	json_reader r(text);
+
+	r.read();
+
+	schema_json root(r, 0);
+
+	if (r.read())
+		throw runtime_error("Trailing data after schema.");
+
+	compile(root, "");
+
+	while (!refs.empty()) {
+		auto [n, pointer] = move(refs.back());
+
+		refs.pop_back();
+
+		auto it = find_if(compiled.begin(), compiled.end(), [&](const auto& c) {
+			return c.first == pointer;
+		});
+
+		if (it != compiled.end())
+			nodes[n].ref = it->second;
+		else
+			nodes[n].ref = compile(root.at(pointer), pointer);
+	}
+
+	for (const auto& n : nodes) {
+		auto s = &n;
+
+		for (size_t i = 0; s->alias; i++) {
+			if (i == nodes.size())
+				throw runtime_error("Schema refers to itself without applying anything.");
+
+			s = &nodes[*s->ref];
+		}
+	}
+}
+
+constexpr size_t compiled_schema::compile_child(const schema_json& j, const string& pointer, string_view key) {
+	return compile(j, pointer + "/" + escape_pointer(key));
+}
+
+constexpr size_t compiled_schema::compile(const schema_json& j, const string& pointer) {
+	auto idx = nodes.size();
+
+	nodes.emplace_back();
+	compiled.emplace_back(pointer, idx);
+
+	if (j.type == json_node::boolean) {
+		nodes[idx].never = j.text == "false";
+		return idx;
+	}
+
+	if (j.type != json_node::object)
+		throw runtime_error("Schema at \"" + pointer + "\" is not an object or boolean.");
+
+	// compiling subschemas adds to nodes, so this is moved there at the end
+	schema_node node;
+
+	auto num = [&](string_view kw) -> optional<double> {
+		auto v = j.find(kw);
+
+		if (!v)
+			return nullopt;
+
+		if (v->type != json_node::number)
+			throw runtime_error(string{kw} + " must be a number.");
+
+		return to_double(v->text);
+	};
+
+	auto count = [&](string_view kw) -> optional<size_t> {
+		auto v = j.find(kw);
+
+		if (!v)
+			return nullopt;
+
+		if (v->type != json_node::number || v->text.length() > 19 || v->text.find_first_not_of("0123456789") != string::npos)
+			throw runtime_error(string{kw} + " must be a non-negative integer.");
+
+		size_t n = 0;
+
+		for (auto c : v->text) {
+			n = (n * 10) + (size_t)(c - '0');
+		}
+
+		return n;
+	};
+
+	auto child = [&](string_view kw) -> optional<size_t> {
+		auto v = j.find(kw);
+
+		if (!v)
+			return nullopt;
+
+		return compile(*v, pointer + "/" + string{kw});
+	};
+
+	auto children = [&](string_view kw) {
+		vector<size_t> ret;
+		auto v = j.find(kw);
+
+		if (!v)
+			return ret;
+
+		if (v->type != json_node::array || v->children.empty())
+			throw runtime_error(string{kw} + " must be a non-empty array.");
+
+		for (size_t i = 0; i < v->children.size(); i++) {
+			string p = pointer + "/" + string{kw} + "/";
+
+			append_number(p, i);
+			ret.push_back(compile(v->children[i], p));
+		}
+
+		return ret;
+	};
+
+	if (auto v = j.find("type")) {
+		auto add_type = [&](const schema_json& t) {
+			if (t.type != json_node::string)
+				throw runtime_error("type must be a string or array of strings.");
+
+			auto name = t.get_string();
+			auto it = find(begin(type_names), end(type_names), name);
+
+			if (it == end(type_names))
+				throw runtime_error("Unknown type " + name + ".");
+
+			node.types |= (uint8_t)(1 << (it - begin(type_names)));
+		};
+
+		if (v->type == json_node::array) {
+			for (const auto& t : v->children) {
+				add_type(t);
+			}
+		} else
+			add_type(*v);
+	}
+
+	if (auto v = j.find("enum")) {
+		if (v->type != json_node::array)
+			throw runtime_error("enum must be an array.");
+
+		for (const auto& e : v->children) {
+			node.enum_values.push_back(canonical_hash(e.text));
+		}
+	}
+
+	if (auto v = j.find("const"))
+		node.const_value = canonical_hash(v->text);
+
+	node.minimum = num("minimum");
+	node.maximum = num("maximum");
+	node.multiple_of = num("multipleOf");
+
+	// In draft 4, exclusiveMinimum and exclusiveMaximum were booleans that
+	// changed the meaning of minimum and maximum.
+	if (auto v = j.find("exclusiveMinimum"); v && v->type == json_node::boolean) {
+		if (v->text == "true")
+			swap(node.minimum, node.exclusive_minimum);
+	} else
+		node.exclusive_minimum = num("exclusiveMinimum");
+
+	if (auto v = j.find("exclusiveMaximum"); v && v->type == json_node::boolean) {
+		if (v->text == "true")
+			swap(node.maximum, node.exclusive_maximum);
+	} else
+		node.exclusive_maximum = num("exclusiveMaximum");
+
+	if (node.multiple_of && *node.multiple_of <= 0)
+		throw runtime_error("multipleOf must be greater than 0.");
+
+	node.min_length = count("minLength");
+	node.max_length = count("maxLength");
+
+	if (auto v = j.find("pattern")) {
+		if (v->type != json_node::string)
+			throw runtime_error("pattern must be a string.");
+
+		node.pattern.emplace(v->get_string());
+	}
+
+	node.min_items = count("minItems");
+	node.max_items = count("maxItems");
+
+	// Before 2020-12, an array for items meant what prefixItems does now, and
+	// additionalItems what items does.
+	if (j.find("prefixItems")) {
+		node.prefix_items = children("prefixItems");
+		node.items = child("items");
+	} else if (auto v = j.find("items"); v && v->type == json_node::array) {
+		node.prefix_items = children("items");
+		node.items = child("additionalItems");
+	} else
+		node.items = child("items");
+
+	node.contains = child("contains");
+
+	if (auto v = j.find("uniqueItems")) {
+		if (v->type != json_node::boolean)
+			throw runtime_error("uniqueItems must be a boolean.");
+
+		node.unique_items = v->text == "true";
+	}
+
+	node.min_properties = count("minProperties");
+	node.max_properties = count("maxProperties");
+
+	if (auto v = j.find("properties")) {
+		vector<pair<string, size_t>> props;
+
+		if (v->type != json_node::object)
+			throw runtime_error("properties must be an object.");
+
+		for (const auto& p : v->children) {
+			props.emplace_back(p.key, compile_child(p, pointer + "/properties", p.key));
+		}
+
+		sort(props.begin(), props.end());
+		node.properties = move(props);
+	}
+
+	if (auto v = j.find("patternProperties")) {
+		vector<pair<schema_regex, size_t>> props;
+
+		if (v->type != json_node::object)
+			throw runtime_error("patternProperties must be an object.");
+
+		for (const auto& p : v->children) {
+			props.emplace_back(schema_regex(p.key), compile_child(p, pointer + "/patternProperties", p.key));
+		}
+
+		node.pattern_properties = move(props);
+	}
+
+	node.additional_properties = child("additionalProperties");
+
+	if (auto v = j.find("required")) {
+		vector<string> req;
+
+		if (v->type != json_node::array)
+			throw runtime_error("required must be an array.");
+
+		for (const auto& r : v->children) {
+			if (r.type != json_node::string)
+				throw runtime_error("required must be an array of strings.");
+
+			req.push_back(r.get_string());
+		}
+
+		sort(req.begin(), req.end());
+		req.erase(unique(req.begin(), req.end()), req.end());
+		node.required = move(req);
+	}
+
+	node.property_names = child("propertyNames");
+
+	if (auto v = j.find("$ref")) {
+		if (v->type != json_node::string)
+			throw runtime_error("$ref must be a string.");
+
+		auto ref = v->get_string();
+
+		if (ref.empty() || ref.front() != '#')
+			throw runtime_error("Only references within the schema are supported.");
+
+		refs.emplace_back(idx, ref.substr(1));
+
+		// a schema that's only a reference is followed rather than applied
+		node.alias = j.children.size() == 1;
+	}
+
+	node.all_of = children("allOf");
+	node.any_of = children("anyOf");
+	node.one_of = children("oneOf");
+	node.not_schema = child("not");
+
+	if (j.find("if")) {
+		node.if_schema = child("if");
+		node.then_schema = child("then");
+		node.else_schema = child("else");
+	}
+
+	nodes[idx] = move(node);
+
+	return idx;
+}
+
+// Validates one document against a compiled schema, stopping at the first error.
+// Anything that only needs to be looked at once is checked as it's read -
+// where a value has to be checked against more than one schema, e.g. for anyOf,
+// its text is read again for each of them. If the input is streamed, that
+// value's text is copied out first, but nothing else is kept.
+class schema_validator {
+public:
+	constexpr schema_validator(const compiled_schema& s, unsigned int max_depth) : nodes(s.nodes), max_depth(max_depth) { }
+
+	constexpr bool validate(size_t n, json_reader& r);
+
+	string error;
+
+private:
+	// Keys are copied into key_text, as those of a streaming reader don't
+	// last, and are as in the JSON.
+	struct path_step {
+		size_t key_off, key_len;
+		optional<size_t> index; // if it's an array element
+	};
+
+	constexpr bool fail(string_view keyword, string_view message);
+	constexpr bool fail_hard(string_view keyword, string_view message);
+	constexpr bool validate_number(const schema_node& s, string_view raw);
+	constexpr bool validate_string(const schema_node& s, json_enc_string_view sv);
+	constexpr bool validate_object(const schema_node& s, json_reader& r);
+	constexpr bool validate_array(const schema_node& s, json_reader& r);
+	constexpr bool validate_value(size_t n, json_reader& r);
+	constexpr bool validate_type(const schema_node& s, json_reader& r);
+	constexpr bool validate_span(size_t n, string_view span);
+	constexpr bool check_quietly(size_t n, string_view span);
+
+	const vector<schema_node>& nodes;
+	unsigned int max_depth;
+	vector<path_step> path;
+	string key_text;
+	bool quiet = false; // if we're only finding out whether something matches
+	bool hard = false; // if error has been set by fail_hard
+	unsigned int nesting = 0;
+	unsigned int depth = 0;
+};
+
+static constexpr unsigned int max_nesting = 256;
+
+// validate() recurses for each level of the document, as well as for each
+// schema it's checked against, so this keeps it well within a 1 MB stack
+static constexpr unsigned int default_max_depth = 1000;
+
+// The text of the value r is on, for where it has to be looked at more than
+// once, leaving r on its last token. If r is streaming, the value is copied
+// into storage - otherwise it's a view of the input.
+static constexpr string_view take_value(json_reader& r, string& storage) {
+	if (r.streaming()) {
+		storage.clear();
+		r.copy(storage);
+
+		return storage;
+	}
+
+	auto start = r.raw().data();
+
+	r.skip();
+
+	return string_view(start, (size_t)(r.raw().data() + r.raw().length() - start));
+}
+
+static constexpr bool is_identifier(string_view s) {
+	if (s.empty() || (s.front() >= '0' && s.front() <= '9'))
+		return false;
+
+	return all_of(s.begin(), s.end(), [](char c) {
+		return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_' || c == '$';
+	});
+}
+
+// Reports the path in the syntax JSON_VALUE takes, e.g. $.a[2]."b c".
+constexpr bool schema_validator::fail(string_view keyword, string_view message) {
+	if (quiet || hard)
+		return false;
+
+	string p = "$";
+
+	for (const auto& step : path) {
+		if (!step.index) {
+			auto k = json_enc_string_view{string_view(key_text).substr(step.key_off, step.key_len)}.decode();
+
+			p += '.';
+
+			if (is_identifier(k))
+				p += k;
+			else
+				append_json_string(p, k);
+		} else {
+			p += '[';
+			append_number(p, *step.index);
+			p += ']';
+		}
+	}
+
+	error = "{\"path\":";
+	append_json_string(error, p);
+	error += ",\"keyword\":";
+	append_json_string(error, keyword);
+	error += ",\"message\":";
+	append_json_string(error, message);
+	error += "}";
+
+	return false;
+}
+
+// For an error that has to be reported even within anyOf, not, etc., as it
+// says nothing about whether the value matches. Nothing matches after this.
+constexpr bool schema_validator::fail_hard(string_view keyword, string_view message) {
+	quiet = false;
+	fail(keyword, message);
+	hard = true;
+
+	return false;
+}
+
+constexpr bool schema_validator::validate_span(size_t n, string_view span) {
+	// a schema that refers to itself could otherwise recurse forever
+	if (nesting == max_nesting)
+		return fail_hard("$ref", "Schemas are nested too deeply.");
+
+	json_reader r(span);
+	auto path_len = path.size();
+
+	r.read();
+
+	nesting++;
+
+	auto ret = validate(n, r);
+
+	nesting--;
+
+	// if it failed quietly, the steps for where it failed are still there
+	if (path.size() > path_len) {
+		key_text.resize(path[path_len].key_off);
+		path.resize(path_len);
+	}
+
+	return ret;
+}
+
+constexpr bool schema_validator::check_quietly(size_t n, string_view span) {
+	auto old = quiet;
+
+	quiet = true;
+
+	auto ret = validate_span(n, span);
+
+	quiet = old;
+
+	return ret;
+}
+
+constexpr bool schema_validator::validate_number(const schema_node& s, string_view raw) {
+	auto d = to_double(raw);
+
+	if (s.minimum && d < *s.minimum)
+		return fail("minimum", "Number is less than the minimum.");
+
+	if (s.maximum && d > *s.maximum)
+		return fail("maximum", "Number is greater than the maximum.");
+
+	if (s.exclusive_minimum && d <= *s.exclusive_minimum)
+		return fail("exclusiveMinimum", "Number is not greater than the exclusive minimum.");
+
+	if (s.exclusive_maximum && d >= *s.exclusive_maximum)
+		return fail("exclusiveMaximum", "Number is not less than the exclusive maximum.");
+
+	if (s.multiple_of) {
+		auto q = d / *s.multiple_of;
+
+		if (!is_finite(q) || magnitude(q - nearest_whole(q)) > 1e-9 * max(1.0, magnitude(q)))
+			return fail("multipleOf", "Number is not a multiple of multipleOf.");
+	}
+
+	return true;
+}
+
+constexpr bool schema_validator::validate_string(const schema_node& s, json_enc_string_view sv) {
+	string decoded;
+	string_view v = sv.raw();
+
+	if (v.find('\\') != string::npos) {
+		decoded = sv.decode();
+		v = decoded;
+	}
+
+	if (s.min_length || s.max_length) {
+		// in code points
+		auto len = (size_t)count_if(v.begin(), v.end(), [](char c) {
+			return ((uint8_t)c & 0xc0) != 0x80;
+		});
+
+		if (s.min_length && len < *s.min_length)
+			return fail("minLength", "String is shorter than minLength.");
+
+		if (s.max_length && len > *s.max_length)
+			return fail("maxLength", "String is longer than maxLength.");
+	}
+
+	if (s.pattern && !s.pattern->search(v))
+		return fail("pattern", "String does not match pattern.");
+
+	return true;
+}
+
+static constexpr bool matches(string_view pattern, string_view s) {
+	return schema_regex(pattern).search(s);
+}
+
+static constexpr bool long_match(string_view pattern, size_t len, char c) {
+	return schema_regex(pattern).search(string(len, c));
+}
+
+static_assert(matches("b", "abc") && !matches("^b", "abc") && matches("c$", "abc") && !matches("b$", "abc"));
+static_assert(matches("^a.c$", "abc") && !matches("^a.c$", "a\nc") && matches("^a.$", "a\xc3\xa9"));
+static_assert(matches("^(ab|cd)+$", "abcdab") && !matches("^(ab|cd)+$", "abca") && matches("^(?:ab)*$", ""));
+static_assert(matches("^a{2,3}$", "aaa") && !matches("^a{2,3}$", "aaaa") && !matches("^a{2}$", "a") && matches("^a{2,}$", "aaaaa"));
+static_assert(matches("^[a-c\\d_]+$", "ab9_c") && !matches("^[^a-c]$", "b") && matches("^[^a-c]$", "\xc3\xa9"));
+static_assert(matches("^\\w+\\s\\W$", "a1 !") && matches("\\bfoo\\b", "a foo b") && !matches("\\bfoo\\b", "afoo"));
+static_assert(matches("^\\x41\\u00e9$", "A\xc3\xa9") && !matches("^\\.$", "a") && matches("a{,2}", "a{,2}"));
+static_assert(matches("^(a*)*b$", "aaab") && !matches("^(a*)*b$", "aaaa") && matches("^(?<x>a|)+$", "aa"));
+static_assert(long_match("^[a-z]+$", 10000, 'a') && !long_match("^[a-z]+$", 10000, '0'));
+static_assert(long_match("(a|aa)*b", 1000, 'a') == false);
+
+constexpr bool schema_validator::validate_object(const schema_node& s, json_reader& r) {
+	vector<bool> found(s.required.size());
+	size_t count = 0;
+	string decoded, text;
+	size_t matches[2];
+
+	while (r.read() && r.node_type() == json_node::key) {
+		auto sv = r.string_value();
+		string_view k = sv.raw();
+		size_t num_matches = 0;
+		bool more_matches = false;
+
+		count++;
+
+		if (s.max_properties && count > *s.max_properties)
+			return fail("maxProperties", "Object has more than maxProperties members.");
+
+		// the key is still needed once r has moved on to its value
+		if (k.find('\\') != string::npos) {
+			decoded = sv.decode();
+			k = decoded;
+		} else if (r.streaming()) {
+			decoded = k;
+			k = decoded;
+		}
+
+		if (!s.required.empty()) {
+			auto it = lower_bound(s.required.begin(), s.required.end(), k);
+
+			if (it != s.required.end() && *it == k)
+				found[(size_t)(it - s.required.begin())] = true;
+		}
+
+		path.push_back({key_text.length(), sv.raw().length(), nullopt});
+		key_text += sv.raw();
+
+		if (s.property_names) {
+			json_reader kr(r.raw());
+
+			kr.read();
+
+			if (!validate(*s.property_names, kr))
+				return false;
+		}
+
+		auto add_match = [&](size_t n) {
+			if (num_matches < 2)
+				matches[num_matches++] = n;
+			else
+				more_matches = true;
+		};
+
+		auto it = lower_bound(s.properties.begin(), s.properties.end(), k, [](const auto& p, string_view key) {
+			return p.first < key;
+		});
+
+		if (it != s.properties.end() && it->first == k)
+			add_match(it->second);
+
+		for (const auto& [re, n] : s.pattern_properties) {
+			if (re.search(k))
+				add_match(n);
+		}
+
+		if (num_matches == 0 && s.additional_properties) {
+			if (nodes[*s.additional_properties].never)
+				return fail("additionalProperties", "Property is not allowed.");
+
+			add_match(*s.additional_properties);
+		}
+
+		r.read();
+
+		if (num_matches == 0)
+			r.skip();
+		else if (num_matches == 1) {
+			if (!validate(matches[0], r))
+				return false;
+		} else {
+			// matched by properties and patternProperties
+			auto span = take_value(r, text);
+
+			if (!validate_span(matches[0], span) || !validate_span(matches[1], span))
+				return false;
+
+			if (more_matches) {
+				for (const auto& [re, n] : s.pattern_properties) {
+					if (n != matches[1] && re.search(k) && !validate_span(n, span))
+						return false;
+				}
+			}
+		}
+
+		key_text.resize(path.back().key_off);
+		path.pop_back();
+	}
+
+	if (s.min_properties && count < *s.min_properties)
+		return fail("minProperties", "Object has fewer than minProperties members.");
+
+	for (size_t i = 0; i < found.size(); i++) {
+		if (!found[i])
+			return fail("required", "Required property \"" + s.required[i] + "\" is missing.");
+	}
+
+	return true;
+}
+
+constexpr bool schema_validator::validate_array(const schema_node& s, json_reader& r) {
+	vector<json_hash> hashes;
+	size_t i = 0;
+	bool contained = false;
+	string text;
+
+	while (r.read() && r.node_type() != json_node::end_array) {
+		if (s.max_items && i >= *s.max_items)
+			return fail("maxItems", "Array has more than maxItems elements.");
+
+		optional<size_t> n = i < s.prefix_items.size() ? s.prefix_items[i] : s.items;
+
+		path.push_back({key_text.length(), 0, i});
+
+		if (s.unique_items || (s.contains && !contained)) {
+			auto span = take_value(r, text);
+
+			if (s.unique_items)
+				hashes.push_back(canonical_hash(span));
+
+			if (s.contains && !contained)
+				contained = check_quietly(*s.contains, span);
+
+			if (n) {
+				json_reader er(span);
+
+				er.read();
+
+				if (!validate(*n, er))
+					return false;
+			}
+		} else if (n) {
+			if (!validate(*n, r))
+				return false;
+		} else
+			r.skip();
+
+		path.pop_back();
+		i++;
+	}
+
+	if (s.min_items && i < *s.min_items)
+		return fail("minItems", "Array has fewer than minItems elements.");
+
+	if (s.contains && !contained)
+		return fail("contains", "Array has no element that matches contains.");
+
+	if (s.unique_items) {
+		sort(hashes.begin(), hashes.end(), [](const auto& a, const auto& b) {
+			return a.lo < b.lo || (a.lo == b.lo && a.hi < b.hi);
+		});
+
+		if (adjacent_find(hashes.begin(), hashes.end()) != hashes.end())
+			return fail("uniqueItems", "Array has duplicate elements.");
+	}
+
+	return true;
+}
+
+// Checks the value r is on against node n, and leaves r on its last token.
+constexpr bool schema_validator::validate(size_t n, json_reader& r) {
+	if (depth == max_depth)
+		return fail_hard("depth", "Value is nested too deeply to be validated.");
+
+	depth++;
+
+	auto ret = validate_value(n, r);
+
+	depth--;
+
+	// e.g. a quiet check that failed hard mustn't count as not matching
+	return ret && !hard;
+}
+
+constexpr bool schema_validator::validate_value(size_t n, json_reader& r) {
+	const auto* s = &nodes[n];
+
+	while (s->alias) {
+		s = &nodes[*s->ref];
+	}
+
+	if (s->never)
+		return fail("false", "No value is allowed here.");
+
+	if (s->has_applicators() || !s->enum_values.empty() || s->const_value) {
+		string text;
+		auto span = take_value(r, text);
+
+		if (s->ref && !validate_span(*s->ref, span))
+			return false;
+
+		for (auto a : s->all_of) {
+			if (!validate_span(a, span))
+				return false;
+		}
+
+		if (!s->any_of.empty() && none_of(s->any_of.begin(), s->any_of.end(), [&](size_t a) { return check_quietly(a, span); }))
+			return fail("anyOf", "Value matches none of the schemas in anyOf.");
+
+		if (!s->one_of.empty()) {
+			size_t matched = 0;
+
+			for (auto a : s->one_of) {
+				if (check_quietly(a, span) && ++matched > 1)
+					break;
+			}
+
+			if (matched != 1)
+				return fail("oneOf", matched == 0 ? "Value matches none of the schemas in oneOf." : "Value matches more than one schema in oneOf.");
+		}
+
+		if (s->not_schema && check_quietly(*s->not_schema, span))
+			return fail("not", "Value matches the schema in not.");
+
+		if (s->if_schema) {
+			if (check_quietly(*s->if_schema, span)) {
+				if (s->then_schema && !validate_span(*s->then_schema, span))
+					return false;
+			} else if (s->else_schema && !validate_span(*s->else_schema, span))
+				return false;
+		}
+
+		if (!s->enum_values.empty() || s->const_value) {
+			auto h = canonical_hash(span);
+
+			if (!s->enum_values.empty() && find(s->enum_values.begin(), s->enum_values.end(), h) == s->enum_values.end())
+				return fail("enum", "Value is not one of those allowed.");
+
+			if (s->const_value && h != *s->const_value)
+				return fail("const", "Value is not the one allowed.");
+		}
+
+		// r has already been moved past the value
+		json_reader vr(span);
+
+		vr.read();
+
+		return validate_type(*s, vr);
+	}
+
+	return validate_type(*s, r);
+}
+
+// The keywords that apply to the value itself, rather than to the whole of it
+// as applicators do.
+constexpr bool schema_validator::validate_type(const schema_node& s, json_reader& r) {
+	uint8_t type;
+
+	switch (r.node_type()) {
+		case json_node::object:
+			type = type_object;
+			break;
+
+		case json_node::array:
+			type = type_array;
+			break;
+
+		case json_node::string:
+			type = type_string;
+			break;
+
+		case json_node::boolean:
+			type = type_boolean;
+			break;
+
+		case json_node::number: {
+			auto raw = r.raw();
+
+			type = type_number;
+
+			if (raw.find_first_of(".eE") == string::npos)
+				type |= type_integer;
+			else {
+				auto d = to_double(raw);
+
+				if (is_finite(d) && d == nearest_whole(d))
+					type |= type_integer;
+			}
+
+			break;
+		}
+
+		default:
+			type = type_null;
+			break;
+	}
+
+	// an integer is a number too
+	if (s.types && !(s.types & type)) {
+		string msg = "Expected ";
+		bool first = true;
+
+		for (size_t i = 0; i < size(type_names); i++) {
+			if (s.types & (1 << i)) {
+				if (!first)
+					msg += " or ";
+
+				msg += type_names[i];
+				first = false;
+			}
+		}
+
+		return fail("type", msg + ".");
+	}
+
+	switch (r.node_type()) {
+		case json_node::object:
+			if (!s.has_object_keywords()) {
+				r.skip();
+				return true;
+			}
+
+			return validate_object(s, r);
+
+		case json_node::array:
+			if (!s.has_array_keywords()) {
+				r.skip();
+				return true;
+			}
+
+			return validate_array(s, r);
+
+		case json_node::string:
+			return validate_string(s, r.string_value());
+
+		case json_node::number:
+			return validate_number(s, r.raw());
+
+		default:
+			return true;
+	}
+}
+
+constexpr optional<string> compiled_schema::validate(json_reader& r, unsigned int max_depth) const {
+	schema_validator v(*this, max_depth);
+
+	try {
+		if (!r.read())
+			throw runtime_error("Empty JSON.");
+
+		if (!v.validate(0, r))
+			return v.error;
+
+		if (r.read())
+			throw runtime_error("Trailing data after JSON.");
+	} catch (const exception& e) {
+		string s = "{\"path\":\"$\",\"keyword\":\"json\",\"message\":";
+
+		append_json_string(s, e.what());
+		s += "}";
+
+		return s;
+	}
+
+	return nullopt;
+}
+
+// The error, or an empty string if json is valid.
+static constexpr string validate_text(string_view schema, string_view json, unsigned int max_depth = default_max_depth) {
+	compiled_schema s(schema);
+	json_reader r(json);
+
+	return s.validate(r, max_depth).value_or("");
+}
+
+static constexpr bool is_valid(string_view schema, string_view json) {
+	return validate_text(schema, json).empty();
+}
+
+// type, and the schemas true and false
+static_assert(is_valid(R"({"type":"integer"})", "1.0") && is_valid(R"({"type":"number"})", "1") && is_valid("true", "[]"));
+static_assert(validate_text(R"({"type":["string","null"]})", "1") == R"({"path":"$","keyword":"type","message":"Expected null or string."})");
+static_assert(validate_text(R"({"items":false})", "[1]") == R"({"path":"$[0]","keyword":"false","message":"No value is allowed here."})");
+
+// numbers
+static_assert(is_valid(R"({"minimum":1,"maximum":2})", "2") && !is_valid(R"({"minimum":1})", "0.5") && !is_valid(R"({"maximum":1})", "1e1"));
+static_assert(!is_valid(R"({"exclusiveMinimum":1})", "1") && !is_valid(R"({"minimum":1,"exclusiveMinimum":true})", "1"));
+static_assert(!is_valid(R"({"exclusiveMaximum":1})", "1") && is_valid(R"({"maximum":1,"exclusiveMaximum":false})", "1"));
+static_assert(is_valid(R"({"multipleOf":0.1})", "0.3") && !is_valid(R"({"multipleOf":2})", "3"));
+
+// strings
+static_assert(is_valid(R"({"maxLength":2})", "\"\xc3\xa9\xc3\xa9\"") && !is_valid(R"({"minLength":2})", "\"\\u00e9\""));
+static_assert(validate_text(R"({"pattern":"^a+$"})", "\"ab\"") == R"({"path":"$","keyword":"pattern","message":"String does not match pattern."})");
+
+// arrays
+static_assert(is_valid(R"({"prefixItems":[{"type":"string"}],"items":{"type":"integer"}})", R"(["a",1,2])"));
+static_assert(validate_text(R"({"items":[{"type":"string"}],"additionalItems":{"type":"integer"}})", R"(["a",1,"b"])") ==
+			  R"({"path":"$[2]","keyword":"type","message":"Expected integer."})");
+static_assert(!is_valid(R"({"minItems":2})", "[1]") && !is_valid(R"({"maxItems":1})", "[1,2]"));
+static_assert(is_valid(R"({"contains":{"type":"string"}})", R"([1,"a"])") && !is_valid(R"({"contains":{"type":"string"}})", "[1,2]"));
+static_assert(!is_valid(R"({"uniqueItems":true})", R"([{"a":1,"b":2},{"b":2,"a":1.0}])") && is_valid(R"({"uniqueItems":true})", "[1,\"1\"]"));
+
+// objects
+static_assert(validate_text(R"({"properties":{"a b":{"properties":{"c":{"items":{"minimum":1}}}}}})", R"({"a b":{"c":[1,0]}})") ==
+			  R"({"path":"$.\"a b\".c[1]","keyword":"minimum","message":"Number is less than the minimum."})");
+static_assert(validate_text(R"({"required":["a","b"]})", R"({"b":1})") == R"({"path":"$","keyword":"required","message":"Required property \"a\" is missing."})");
+static_assert(!is_valid(R"({"properties":{"a":true},"additionalProperties":false})", R"({"a":1,"b":2})"));
+static_assert(is_valid(R"({"patternProperties":{"^x":{"type":"integer"}},"additionalProperties":false})", R"({"x1":1,"x2":2})"));
+static_assert(!is_valid(R"({"properties":{"xa":{"minimum":0}},"patternProperties":{"a$":{"maximum":0}}})", R"({"xa":1})"));
+static_assert(!is_valid(R"({"propertyNames":{"maxLength":1}})", R"({"ab":1})") && !is_valid(R"({"minProperties":1})", "{}"));
+static_assert(!is_valid(R"({"maxProperties":1})", R"({"a":1,"b":2})"));
+
+// enum and const, which compare as JSON_HASH does
+static_assert(is_valid(R"({"enum":[{"a":[1,2]},"x"]})", R"({"a":[1.0,2e0]})") && !is_valid(R"({"enum":[{"a":[1,2]}]})", R"({"a":[2,1]})"));
+static_assert(is_valid(R"({"const":"\u0041"})", "\"A\"") && !is_valid(R"({"const":null})", "false"));
+
+// applicators
+static_assert(!is_valid(R"({"allOf":[{"minimum":1},{"maximum":2}]})", "3") && is_valid(R"({"anyOf":[{"type":"string"},{"minimum":1}]})", "1"));
+static_assert(validate_text(R"({"oneOf":[{"type":"integer"},{"minimum":0}]})", "5") ==
+			  R"({"path":"$","keyword":"oneOf","message":"Value matches more than one schema in oneOf."})");
+static_assert(!is_valid(R"({"not":{"type":"string"}})", "\"a\"") && is_valid(R"({"not":{"type":"string"}})", "1"));
+static_assert(!is_valid(R"({"if":{"type":"string"},"then":{"minLength":2},"else":{"minimum":2}})", "1"));
+static_assert(is_valid(R"({"if":{"type":"string"},"then":{"minLength":2},"else":{"minimum":2}})", "\"ab\""));
+static_assert(validate_text(R"({"$defs":{"a/b":{"type":"string"}},"items":{"$ref":"#/$defs/a~1b"}})", R"(["x",1])") ==
+			  R"({"path":"$[1]","keyword":"type","message":"Expected string."})");
+static_assert(!is_valid(R"({"properties":{"next":{"$ref":"#"}},"required":["v"]})", R"({"v":1,"next":{"v":2,"next":{}}})"));
+
+// A check that fails under anyOf, oneOf or not leaves no trace in the path of
+// a later error.
+static_assert(validate_text(R"({"properties":{"a":{"anyOf":[{"properties":{"b":{"items":{"type":"string"}}}},true]},"c":{"type":"string"}}})",
+							R"({"a":{"b":[1]},"c":1})") == R"({"path":"$.c","keyword":"type","message":"Expected string."})");
+static_assert(validate_text(R"({"properties":{"a":{"oneOf":[{"properties":{"b":false}},{"required":["c"]}]},"d":false}})", R"({"a":{"b":1,"c":2},"d":1})") ==
+			  R"({"path":"$.d","keyword":"false","message":"No value is allowed here."})");
+static_assert(validate_text(R"({"properties":{"a":{"not":{"properties":{"b":false}}},"c":false}})", R"({"a":{"b":1},"c":1})") ==
+			  R"({"path":"$.c","keyword":"false","message":"No value is allowed here."})");
+
+// Going too deep is reported, even where a quiet check does it.
+static_assert(validate_text(R"({"items":{"$ref":"#"}})", "[[[[[[[[1]]]]]]]]", 5) ==
+			  R"({"path":"$[0][0][0][0][0]","keyword":"depth","message":"Value is nested too deeply to be validated."})");
+static_assert(validate_text(R"({"anyOf":[{"items":{"$ref":"#"}},true]})", "[[[[[[[[1]]]]]]]]", 5).find("\"depth\"") != string::npos);
+static_assert(validate_text(R"({"not":{"items":{"$ref":"#"}}})", "[[[[[[[[1]]]]]]]]", 5).find("\"depth\"") != string::npos);
+static_assert(is_valid(R"({"items":{"$ref":"#"}})", "[[[[[[[[1]]]]]]]]"));
+
+// Compiled schemas are kept per thread, most recently used first, and found
+// by the hash of their text.
+static const compiled_schema& get_schema(string_view text) {
+	static constexpr size_t cache_size = 8;
+
+	struct entry {
+		size_t hash;
+		string text;
+		unique_ptr<compiled_schema> schema;
+	};
+
+	thread_local vector<entry> cache;
+	auto h = hash<string_view>{}(text);
+
+	auto it = find_if(cache.begin(), cache.end(), [&](const auto& e) {
+		return e.hash == h && e.text == text;
+	});
+
+	if (it != cache.end())
+		rotate(cache.begin(), it, it + 1);
+	else {
+		auto s = make_unique<compiled_schema>(text);
+
+		if (cache.size() == cache_size)
+			cache.pop_back();
+
+		cache.emplace(cache.begin(), h, string{text}, move(s));
+	}
+
+	return *cache.front().schema;
+}
+
+static optional<string> validate_schema(json_reader& r, string_view schema) {
+	const compiled_schema* s;
+
+	try {
+		s = &get_schema(schema);
+	} catch (const exception& e) {
+		string ret = "{\"path\":\"\",\"keyword\":\"schema\",\"message\":";
+
+		append_json_string(ret, e.what());
+		ret += "}";
+
+		return ret;
+	}
+
+	return s->validate(r, default_max_depth);
+}
+
+// Returns NULL if the JSON is valid according to the schema, or otherwise a
+// report of the first error found, e.g.
+// {"path":"$.items[2].qty","keyword":"minimum","message":"..."}. A keyword of
+// "json" means the JSON itself is malformed, "schema" that the schema is, and
+// "depth" that the JSON is nested too deeply to be checked.
+extern "C" __declspec(dllexport) BSTR JSON_SCHEMA_VALIDATE(WCHAR* json, WCHAR* schema) noexcept {
+	if (!json || !schema)
+		return nullptr;
+
+	try {
+		utf16_source src((char16_t*)json);
+		json_reader r(src);
+		auto ret = validate_schema(r, utf16_to_utf8((char16_t*)schema));
+
+		if (!ret)
+			return nullptr;
+
+		return bstr(*ret);
+	} catch (...) {
+		return nullptr;
+	}
+}
+
+extern "C" __declspec(dllexport) BSTR JSON_SCHEMA_VALIDATE_U8(const char* json, UINT len, const char* schema, UINT schemalen) noexcept {
+	if (!json || !schema)
+		return nullptr;
+
+	try {
+		json_reader r(string_view(json, len));
+		auto ret = validate_schema(r, string_view(schema, schemalen));
+
+		if (!ret)
+			return nullptr;
+
+		return bstr_u8(*ret);
+	} catch (...) {
+		return nullptr;
+	}
+}
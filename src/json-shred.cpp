@@ -0,0 +1,239 @@
+#include "jsonfunc.h"
+#include "json.h"
+#include <algorithm>
+
+using namespace std;
+
+// The paths asked for, merged into a tree so that each element can be matched
+// against all of them in one pass.
+struct shred_node {
+	json_path_step step;
+	vector<size_t> columns;
+	vector<shred_node> children;
+};
+
+static void shred_value(json_reader& r, const shred_node& n, vector<string>& row);
+
+static const shred_node* find_child(const shred_node& n, const json_reader& r, size_t index) {
+	for (const auto& c : n.children) {
+		if (r.node_type() == json_node::key) {
+			if (!c.step.index && r.string_value().cmp(c.step.name))
+				return &c;
+		} else if (c.step.index == index)
+			return &c;
+	}
+
+	return nullptr;
+}
+
+static void shred_children(json_reader& r, const shred_node& n, vector<string>& row) {
+	if (r.node_type() == json_node::object) {
+		while (r.read() && r.node_type() == json_node::key) {
+			if (auto c = find_child(n, r, 0)) {
+				r.read();
+				shred_value(r, *c, row);
+			} else
+				r.skip();
+		}
+	} else if (r.node_type() == json_node::array) {
+		auto d = r.depth();
+
+		for (size_t i = 0; r.read() && r.depth() >= d; i++) {
+			if (auto c = find_child(n, r, i))
+				shred_value(r, *c, row);
+			else
+				r.skip();
+		}
+	}
+}
+
+static void shred_value(json_reader& r, const shred_node& n, vector<string>& row) {
+	if (n.columns.empty()) {
+		shred_children(r, n, row);
+		return;
+	}
+
+	auto& v = row[n.columns.front()];
+
+	v.clear();
+	r.copy(v);
+
+	for (size_t i = 1; i < n.columns.size(); i++) {
+		row[n.columns[i]] = v;
+	}
+
+	// a path that's a prefix of another one - read its copy again
+	if (!n.children.empty()) {
+		json_reader r2(v);
+
+		r2.read();
+		shred_children(r2, n, row);
+	}
+}
+
+// Writes a field the way BULK INSERT ... WITH (FORMAT = 'CSV') expects it: quoted
+// if it contains the separator, a quote or a newline, and with quotes doubled.
+// JSON nulls and missing values become empty fields, so are loaded as NULL.
+static void write_field(utf8_writer& s, string_view v, string_view sep) {
+	string dec;
+
+	if (v.empty() || v == "null")
+		return;
+
+	if (v.front() == '"') {
+		dec = json_enc_string_view{v.substr(1, v.length() - 2)}.decode();
+		v = dec;
+
+		if (v.empty()) {
+			s += "\"\"";
+			return;
+		}
+	}
+
+	if (v.find(sep) == string::npos && v.find_first_of("\"\r\n") == string::npos) {
+		s += v;
+		return;
+	}
+
+	s += '"';
+
+	while (!v.empty()) {
+		auto q = v.find('"');
+
+		s += v.substr(0, q);
+
+		if (q == string::npos)
+			break;
+
+		s += "\"\"";
+		v.remove_prefix(q + 1);
+	}
+
+	s += '"';
+}
+
+static void json_shred(json_reader& r, json_reader* paths, string_view sep, utf8_writer& s) {
+	shred_node root;
+	size_t num_columns = 0;
+
+	if (paths) {
+		if (!paths->read() || paths->node_type() != json_node::array)
+			throw runtime_error("Paths must be an array of strings.");
+
+		while (paths->read() && paths->node_type() == json_node::string) {
+			auto n = &root;
+
+			for (auto& step : parse_json_path(paths->string_value().decode())) {
+				auto c = find_if(n->children.begin(), n->children.end(), [&](const shred_node& c) {
+					return c.step.name == step.name && c.step.index == step.index;
+				});
+
+				if (c == n->children.end()) {
+					n->children.push_back({move(step), {}, {}});
+					n = &n->children.back();
+				} else
+					n = &*c;
+			}
+
+			n->columns.push_back(num_columns);
+			num_columns++;
+		}
+
+		if (paths->node_type() != json_node::end_array)
+			throw runtime_error("Paths must be an array of strings.");
+	}
+
+	if (!r.read() || r.node_type() != json_node::array)
+		throw runtime_error("Not an array.");
+
+	if (num_columns == 0) { // one column, picked like JSON_ARRAY does
+		string key, value;
+
+		while (r.read() && r.node_type() != json_node::end_array) {
+			if (select_member(r, key, value) && !key.empty())
+				write_field(s, value, sep);
+
+			s += "\r\n";
+		}
+	} else {
+		vector<string> row(num_columns);
+
+		while (r.read() && r.node_type() != json_node::end_array) {
+			for (auto& v : row) {
+				v.clear();
+			}
+
+			if (root.columns.empty())
+				shred_children(r, root, row);
+			else
+				shred_value(r, root, row);
+
+			for (size_t i = 0; i < row.size(); i++) {
+				if (i != 0)
+					s += sep;
+
+				write_field(s, row[i], sep);
+			}
+
+			s += "\r\n";
+		}
+	}
+
+	if (r.read())
+		throw runtime_error("Trailing characters after JSON.");
+}
+
+extern "C" __declspec(dllexport) BSTR JSON_SHRED(WCHAR* in, WCHAR* pathsw, WCHAR* sepw) noexcept {
+	if (!in)
+		return nullptr;
+
+	try {
+		u16string_view inw = (char16_t*)in;
+		utf16_source src(inw);
+		json_reader r(src);
+		optional<json_reader> paths;
+		string pathsu, sep = sepw ? utf16_to_utf8((char16_t*)sepw) : "\t";
+		utf8_writer s;
+
+		if (sep.empty())
+			return nullptr;
+
+		if (pathsw) {
+			pathsu = utf16_to_utf8((char16_t*)pathsw);
+			paths.emplace(pathsu);
+		}
+
+		s.reserve(inw.length() / 2);
+		json_shred(r, paths ? &*paths : nullptr, sep, s);
+
+		return bstr(s.str());
+	} catch (...) {
+		return nullptr;
+	}
+}
+
+extern "C" __declspec(dllexport) BSTR JSON_SHRED_U8(const char* in, UINT len, const char* pathsu, UINT pathslen,
+													 const char* sepu, UINT seplen) noexcept {
+	if (!in)
+		return nullptr;
+
+	try {
+		json_reader r(string_view(in, len));
+		optional<json_reader> paths;
+		string_view sep = sepu ? string_view(sepu, seplen) : "\t";
+		utf8_writer s;
+
+		if (sep.empty())
+			return nullptr;
+
+		if (pathsu)
+			paths.emplace(string_view(pathsu, pathslen));
+
+		s.reserve(len / 2);
+		json_shred(r, paths ? &*paths : nullptr, sep, s);
+
+		return bstr_u8(s.str());
+	} catch (...) {
+		return nullptr;
+	}
+}
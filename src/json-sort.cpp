@@ -0,0 +1,510 @@
+#include "jsonfunc.h"
+#include "json.h"
+#include "thread-pool.h"
+#include <algorithm>
+#include <charconv>
+
+using namespace std;
+
+// Below this many elements, sorting and printing aren't shared out over the
+// thread pool.
+static constexpr size_t parallel_threshold = 1024;
+
+// Returns the text of each element of the array that sv is, or nullopt if sv
+// is valid JSON but not an array.
+static optional<vector<string_view>> split_elements(string_view sv) {
+	json_reader r(sv);
+	vector<string_view> elements;
+
+	if (!r.read())
+		throw runtime_error("Empty JSON.");
+
+	if (r.node_type() != json_node::array) {
+		r.skip();
+
+		if (r.read())
+			throw runtime_error("Trailing data after JSON.");
+
+		return nullopt;
+	}
+
+	while (r.read() && r.node_type() != json_node::end_array) {
+		auto start = r.raw().data();
+
+		r.skip();
+		elements.emplace_back(start, (size_t)(r.raw().data() + r.raw().length() - start));
+	}
+
+	if (r.read())
+		throw runtime_error("Trailing data after JSON.");
+
+	return elements;
+}
+
+// Pretty prints as JSON_PRETTY does, but with the members of each object sorted
+// by key, so that documents that differ only in their order come out the same.
+// The members of an object are written as they come, and then moved into order
+// once it's been closed. base is the depth that the value is being printed at.
+static constexpr void json_pretty_sorted(json_reader& r, string& s, size_t base) {
+	struct member {
+		size_t start, end; // where it is in s
+		size_t key_len;
+	};
+
+	vector<vector<member>> stack; // for each object or array that's open - empty for the latter
+	size_t open = 0; // the vectors in stack past this are kept once closed, so that they can be reused
+	bool first = false, after_key = false;
+	vector<pair<string_view, size_t>> keys;
+	vector<string> decoded;
+	string old;
+
+	auto newline = [&](size_t depth) {
+		s += "\n";
+		s.append((base + depth) * 3, ' ');
+	};
+
+	// duplicated keys are left in the order they were in
+	auto sort_members = [&](const vector<member>& members, size_t depth) {
+		keys.clear();
+		decoded.clear();
+
+		for (size_t i = 0; i < members.size(); i++) {
+			auto k = string_view(s).substr(members[i].start + 1, members[i].key_len);
+
+			if (k.find('\\') != string::npos) {
+				// so that the views of the others stay valid
+				if (decoded.capacity() < members.size())
+					decoded.reserve(members.size());
+
+				decoded.push_back(json_enc_string_view{k}.decode());
+				k = decoded.back();
+			}
+
+			keys.emplace_back(k, i);
+		}
+
+		if (is_sorted(keys.begin(), keys.end()))
+			return;
+
+		sort(keys.begin(), keys.end());
+
+		auto start = members.front().start;
+
+		old.assign(string_view(s).substr(start, members.back().end - start));
+		s.resize(start);
+
+		for (size_t i = 0; i < keys.size(); i++) {
+			const auto& m = members[keys[i].second];
+
+			if (i != 0) {
+				s += ",";
+				newline(depth);
+			}
+
+			s += string_view(old).substr(m.start - start, m.end - m.start);
+		}
+	};
+
+	while (r.read()) {
+		switch (r.node_type()) {
+			case json_node::end_object:
+			case json_node::end_array: {
+				auto& members = stack[open - 1];
+
+				if (!members.empty()) {
+					members.back().end = s.length();
+
+					if (members.size() > 1)
+						sort_members(members, r.depth() + 1);
+				}
+
+				if (!first)
+					newline(r.depth());
+
+				s += r.raw();
+				first = false;
+				open--;
+				break;
+			}
+
+			default: {
+				auto opening = r.node_type() == json_node::object || r.node_type() == json_node::array;
+				auto depth = opening ? r.depth() - 1 : r.depth();
+				auto key = r.node_type() == json_node::key;
+
+				if (key && !stack[open - 1].empty())
+					stack[open - 1].back().end = s.length();
+
+				if (after_key)
+					after_key = false;
+				else if (first)
+					newline(depth);
+				else if (depth > 0) {
+					s += ",";
+					newline(depth);
+				}
+
+				if (key)
+					stack[open - 1].push_back({s.length(), 0, r.raw().length() - 2});
+
+				s += r.raw();
+				first = opening;
+
+				if (opening) {
+					if (open == stack.size())
+						stack.emplace_back();
+
+					stack[open].clear();
+					open++;
+				}
+
+				if (key) {
+					s += ": ";
+					after_key = true;
+				}
+
+				break;
+			}
+		}
+	}
+}
+
+static constexpr string json_pretty_sorted(string_view in) {
+	json_reader r(in);
+	string s;
+
+	json_pretty_sorted(r, s, 0);
+
+	return s;
+}
+
+static_assert(json_pretty_sorted("{\"z\":true,\"a\":null,\"m\":false}") == "{\n   \"a\": null,\n   \"m\": false,\n   \"z\": true\n}");
+static_assert(json_pretty_sorted("{\"b\":{\"y\":[1,{\"d\":1,\"c\":2}],\"x\":{}},\"a\":[]}") == R"({
+   "a": [],
+   "b": {
+      "x": {},
+      "y": [
+         1,
+         {
+            "c": 2,
+            "d": 1
+         }
+      ]
+   }
+})");
+static_assert(json_pretty_sorted("{\"a\":2,\"b\":1,\"a\":1}") == "{\n   \"a\": 2,\n   \"a\": 1,\n   \"b\": 1\n}");
+static_assert(json_pretty_sorted("[{\"b\":1,\"a\":2},{}]") == "[\n   {\n      \"a\": 2,\n      \"b\": 1\n   },\n   {}\n]");
+static_assert(json_pretty_sorted("\"text\"") == "\"text\"");
+static_assert(json_pretty_sorted("{}") == "{}");
+
+// The elements of a large array are printed in parallel, and then joined.
+static string pretty_sorted(string_view in) {
+	auto elements = split_elements(in);
+	string s;
+
+	if (!elements || elements->size() < parallel_threshold) {
+		json_reader r(in);
+
+		s.reserve(in.length() * 2);
+		json_pretty_sorted(r, s, 0);
+
+		return s;
+	}
+
+	vector<string> parts(elements->size());
+
+	thread_pool::get().parallel_for(parts.size(), [&](size_t i) {
+		json_reader r((*elements)[i]);
+
+		json_pretty_sorted(r, parts[i], 1);
+	});
+
+	size_t len = 2;
+
+	for (const auto& p : parts) {
+		len += p.length() + 5;
+	}
+
+	s.reserve(len);
+	s += "[";
+
+	for (size_t i = 0; i < parts.size(); i++) {
+		s += i == 0 ? "\n   " : ",\n   ";
+		s += parts[i];
+	}
+
+	s += "\n]";
+
+	return s;
+}
+
+extern "C" __declspec(dllexport) BSTR JSON_PRETTY_SORTED(WCHAR* in) noexcept {
+	if (!in)
+		return nullptr;
+
+	try {
+		return bstr(pretty_sorted(utf16_to_utf8((char16_t*)in)));
+	} catch (...) {
+		return nullptr;
+	}
+}
+
+extern "C" __declspec(dllexport) BSTR JSON_PRETTY_SORTED_U8(const char* in, UINT len) noexcept {
+	if (!in)
+		return nullptr;
+
+	try {
+		return bstr_u8(pretty_sorted(string_view(in, len)));
+	} catch (...) {
+		return nullptr;
+	}
+}
+
+struct sort_path {
+	json_path path;
+	bool desc;
+};
+
+// Parses e.g. "$.a, $.b.c DESC" - paths separated by commas, each of which can
+// be followed by ASC or DESC.
+static vector<sort_path> parse_sort_paths(string_view sv) {
+	vector<sort_path> paths;
+
+	auto trim = [](string_view& t) {
+		while (!t.empty() && (t.front() == ' ' || t.front() == '\t')) {
+			t.remove_prefix(1);
+		}
+
+		while (!t.empty() && (t.back() == ' ' || t.back() == '\t')) {
+			t.remove_suffix(1);
+		}
+	};
+
+	auto ends_with_word = [](string_view t, string_view word) {
+		if (t.length() <= word.length() || (t[t.length() - word.length() - 1] != ' ' && t[t.length() - word.length() - 1] != '\t'))
+			return false;
+
+		for (size_t i = 0; i < word.length(); i++) {
+			if ((t[t.length() - word.length() + i] & ~0x20) != word[i])
+				return false;
+		}
+
+		return true;
+	};
+
+	while (true) {
+		bool quoted = false;
+		size_t end = 0;
+
+		// commas within quoted names don't count
+		for (; end < sv.length() && (quoted || sv[end] != ','); end++) {
+			if (sv[end] == '"')
+				quoted = !quoted;
+			else if (sv[end] == '\\' && quoted)
+				end++;
+		}
+
+		auto item = sv.substr(0, end);
+		bool desc = false;
+
+		trim(item);
+
+		if (ends_with_word(item, "DESC")) {
+			desc = true;
+			item.remove_suffix(4);
+		} else if (ends_with_word(item, "ASC"))
+			item.remove_suffix(3);
+
+		trim(item);
+		paths.push_back({parse_json_path(item), desc});
+
+		if (end >= sv.length())
+			break;
+
+		sv.remove_prefix(end + 1);
+	}
+
+	return paths;
+}
+
+// The value at one of the paths of one element, in a form that's quick to
+// compare. Missing values sort first, then nulls, false, true, numbers, strings,
+// and then objects and arrays, which all count as the same.
+struct sort_key {
+	enum class rank : uint8_t {
+		missing,
+		null,
+		false_value,
+		true_value,
+		number,
+		string,
+		container
+	} r;
+
+	double num;
+	string str;
+
+	strong_ordering operator<=>(const sort_key& k) const {
+		if (r != k.r)
+			return r <=> k.r;
+
+		if (r == rank::number)
+			return num < k.num ? strong_ordering::less : (num > k.num ? strong_ordering::greater : strong_ordering::equal);
+
+		if (r == rank::string)
+			return str <=> k.str;
+
+		return strong_ordering::equal;
+	}
+};
+
+static sort_key get_sort_key(string_view element, const json_path& path) {
+	json_reader r(element);
+
+	if (!find_path(r, path))
+		return {sort_key::rank::missing, 0, {}};
+
+	switch (r.node_type()) {
+		case json_node::null:
+			return {sort_key::rank::null, 0, {}};
+
+		case json_node::boolean:
+			return {r.raw() == "true" ? sort_key::rank::true_value : sort_key::rank::false_value, 0, {}};
+
+		case json_node::number: {
+			auto raw = r.raw();
+			double d = 0;
+
+			// too large gives infinity, and too small 0
+			if (from_chars(raw.data(), raw.data() + raw.length(), d).ec == errc::result_out_of_range) {
+				if (raw.find("e-") != string::npos || raw.find("E-") != string::npos)
+					d = 0;
+				else
+					d = raw.front() == '-' ? -numeric_limits<double>::infinity() : numeric_limits<double>::infinity();
+			}
+
+			return {sort_key::rank::number, d, {}};
+		}
+
+		case json_node::string:
+			return {sort_key::rank::string, 0, r.string_value().decode()};
+
+		default:
+			return {sort_key::rank::container, 0, {}};
+	}
+}
+
+// A merge sort over the thread pool: runs are sorted in parallel, and then
+// merged in pairs, each round of merges in parallel too. It's stable.
+template<typename T, typename C>
+static void parallel_sort(vector<T>& v, C cmp) {
+	if (v.size() < parallel_threshold) {
+		stable_sort(v.begin(), v.end(), cmp);
+		return;
+	}
+
+	auto& pool = thread_pool::get();
+	auto runs = pool.threads() * 4;
+	auto run_len = (v.size() + runs - 1) / runs;
+	vector<T> buf(v.size());
+
+	pool.parallel_for(runs, [&](size_t i) {
+		auto begin = min(i * run_len, v.size()), end = min((i + 1) * run_len, v.size());
+
+		stable_sort(v.begin() + (ptrdiff_t)begin, v.begin() + (ptrdiff_t)end, cmp);
+	});
+
+	for (; run_len < v.size(); run_len *= 2) {
+		auto pairs = (v.size() + (2 * run_len) - 1) / (2 * run_len);
+
+		pool.parallel_for(pairs, [&](size_t i) {
+			auto begin = i * 2 * run_len;
+			auto mid = min(begin + run_len, v.size()), end = min(begin + (2 * run_len), v.size());
+
+			merge(v.begin() + (ptrdiff_t)begin, v.begin() + (ptrdiff_t)mid, v.begin() + (ptrdiff_t)mid,
+				  v.begin() + (ptrdiff_t)end, buf.begin() + (ptrdiff_t)begin, cmp);
+		});
+
+		v.swap(buf);
+	}
+}
+
+// Sorts the elements of an array by the values at one or more paths within
+// each of them. The keys are extracted once, in parallel, before sorting. The
+// elements themselves are copied as they are.
+static string json_sort(string_view in, string_view paths_sv) {
+	auto paths = parse_sort_paths(paths_sv);
+	auto elements = split_elements(in);
+
+	if (!elements)
+		throw runtime_error("JSON_SORT needs an array.");
+
+	auto n = elements->size();
+	vector<sort_key> keys(n * paths.size());
+	vector<uint32_t> order(n);
+
+	if (n > numeric_limits<uint32_t>::max())
+		throw runtime_error("Array too large to sort.");
+
+	thread_pool::get().parallel_for(n, [&](size_t i) {
+		for (size_t j = 0; j < paths.size(); j++) {
+			keys[(i * paths.size()) + j] = get_sort_key((*elements)[i], paths[j].path);
+		}
+
+		order[i] = (uint32_t)i;
+	});
+
+	parallel_sort(order, [&](uint32_t a, uint32_t b) {
+		for (size_t j = 0; j < paths.size(); j++) {
+			auto c = keys[(a * paths.size()) + j] <=> keys[(b * paths.size()) + j];
+
+			if (c != 0)
+				return paths[j].desc ? c > 0 : c < 0;
+		}
+
+		return false;
+	});
+
+	string s;
+	size_t len = 2;
+
+	for (auto e : *elements) {
+		len += e.length() + 1;
+	}
+
+	s.reserve(len);
+	s += "[";
+
+	for (size_t i = 0; i < n; i++) {
+		if (i != 0)
+			s += ",";
+
+		s += (*elements)[order[i]];
+	}
+
+	s += "]";
+
+	return s;
+}
+
+extern "C" __declspec(dllexport) BSTR JSON_SORT(WCHAR* in, WCHAR* paths) noexcept {
+	if (!in || !paths)
+		return nullptr;
+
+	try {
+		return bstr(json_sort(utf16_to_utf8((char16_t*)in), utf16_to_utf8((char16_t*)paths)));
+	} catch (...) {
+		return nullptr;
+	}
+}
+
+extern "C" __declspec(dllexport) BSTR JSON_SORT_U8(const char* in, UINT len, const char* paths, UINT pathslen) noexcept {
+	if (!in || !paths)
+		return nullptr;
+
+	try {
+		return bstr_u8(json_sort(string_view(in, len), string_view(paths, pathslen)));
+	} catch (...) {
+		return nullptr;
+	}
+}
@@ -0,0 +1,150 @@
+#include "jsonfunc.h"
+#include "json.h"
+#include "jsonb.h"
+#include <algorithm>
+
+using namespace std;
+
+// Compiled paths are kept per thread, most recently used first.
+static const json_path& compiled_path(string_view sv) {
+	static constexpr size_t cache_size = 16;
+	thread_local vector<pair<string, json_path>> cache;
+
+	auto it = find_if(cache.begin(), cache.end(), [&](const auto& p) {
+		return p.first == sv;
+	});
+
+	if (it != cache.end())
+		rotate(cache.begin(), it, it + 1);
+	else {
+		auto path = parse_json_path(sv);
+
+		if (cache.size() == cache_size)
+			cache.pop_back();
+
+		cache.emplace(cache.begin(), string{sv}, move(path));
+	}
+
+	return cache.front().second;
+}
+
+// As find_path for json_reader, but each step is a jump through the index of
+// the object or array.
+static bool find_path(jsonb_reader& r, const json_path& path) {
+	if (!r.read())
+		return false;
+
+	for (const auto& step : path) {
+		if (step.index) {
+			if (r.node_type() != json_node::array || *step.index >= r.size())
+				return false;
+
+			r.seek(*step.index);
+		} else {
+			if (r.node_type() != json_node::object)
+				return false;
+
+			auto [lo, hi] = r.find(step.name);
+
+			if (lo == hi)
+				return false;
+
+			// the first of any duplicates, as when reading the text
+			r.seek(lo);
+			r.read();
+		}
+
+		r.read();
+	}
+
+	return true;
+}
+
+// As with JSON_VALUE in lax mode, objects, arrays, nulls and missing values
+// all give NULL.
+template<typename R>
+static optional<string> json_value(R& r, string_view path) {
+	if (!find_path(r, compiled_path(path)))
+		return nullopt;
+
+	switch (r.node_type()) {
+		case json_node::string:
+			return r.string_value().decode();
+
+		case json_node::number:
+		case json_node::boolean:
+			return string{r.raw()};
+
+		default:
+			return nullopt;
+	}
+}
+
+extern "C" __declspec(dllexport) BSTR JSON_VALUE(WCHAR* in, WCHAR* pathw) noexcept {
+	if (!in || !pathw)
+		return nullptr;
+
+	try {
+		utf16_source src((char16_t*)in);
+		json_reader r(src);
+		auto v = json_value(r, utf16_to_utf8((char16_t*)pathw));
+
+		if (!v)
+			return nullptr;
+
+		return bstr(*v);
+	} catch (...) {
+		return nullptr;
+	}
+}
+
+extern "C" __declspec(dllexport) BSTR JSON_VALUE_U8(const char* in, UINT len, const char* path, UINT pathlen) noexcept {
+	if (!in || !path)
+		return nullptr;
+
+	try {
+		json_reader r(string_view(in, len));
+		auto v = json_value(r, string_view(path, pathlen));
+
+		if (!v)
+			return nullptr;
+
+		return bstr_u8(*v);
+	} catch (...) {
+		return nullptr;
+	}
+}
+
+extern "C" __declspec(dllexport) BSTR JSON_VALUE_BINARY(const char* in, UINT len, WCHAR* pathw) noexcept {
+	if (!in || !pathw)
+		return nullptr;
+
+	try {
+		jsonb_reader r(string_view(in, len));
+		auto v = json_value(r, utf16_to_utf8((char16_t*)pathw));
+
+		if (!v)
+			return nullptr;
+
+		return bstr(*v);
+	} catch (...) {
+		return nullptr;
+	}
+}
+
+extern "C" __declspec(dllexport) BSTR JSON_VALUE_BINARY_U8(const char* in, UINT len, const char* path, UINT pathlen) noexcept {
+	if (!in || !path)
+		return nullptr;
+
+	try {
+		jsonb_reader r(string_view(in, len));
+		auto v = json_value(r, string_view(path, pathlen));
+
+		if (!v)
+			return nullptr;
+
+		return bstr_u8(*v);
+	} catch (...) {
+		return nullptr;
+	}
+}
@@ -0,0 +1,694 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <stdexcept>
+#include <optional>
+#include <vector>
+#include <cstdint>
+#include "source.h"
+
+enum class json_node {
+	none,
+	object,
+	end_object,
+	array,
+	end_array,
+	key,
+	string,
+	number,
+	boolean,
+	null
+};
+
+class json_enc_string_view {
+public:
+	constexpr json_enc_string_view() { }
+	constexpr json_enc_string_view(std::string_view sv) : sv(sv) { }
+
+	constexpr bool empty() const noexcept {
+		return sv.empty();
+	}
+
+	constexpr std::string_view raw() const {
+		return sv;
+	}
+
+	// json_reader has already checked that the escapes are well-formed, but a
+	// string from binary JSON may not have been, so this mustn't read past the end.
+	constexpr std::string decode() const {
+		auto v = sv;
+		std::string s;
+
+		s.reserve(v.length());
+
+		while (!v.empty()) {
+			auto bs = v.find('\\');
+
+			s += v.substr(0, bs);
+
+			if (bs == std::string_view::npos)
+				break;
+
+			v.remove_prefix(bs + 1);
+
+			if (v.empty())
+				break;
+
+			auto c = v.front();
+
+			v.remove_prefix(1);
+
+			switch (c) {
+				case 'b':
+					s += '\b';
+					break;
+
+				case 'f':
+					s += '\f';
+					break;
+
+				case 'n':
+					s += '\n';
+					break;
+
+				case 'r':
+					s += '\r';
+					break;
+
+				case 't':
+					s += '\t';
+					break;
+
+				case 'u': {
+					auto cp = hex_value(v.substr(0, 4));
+
+					v.remove_prefix(v.length() < 4 ? v.length() : 4);
+
+					if (cp >= 0xd800 && cp <= 0xdbff && v.length() >= 6) {
+						cp = 0x10000 + ((cp - 0xd800) << 10) + (hex_value(v.substr(2, 4)) - 0xdc00);
+						v.remove_prefix(6);
+					}
+
+					append_utf8(s, cp);
+					break;
+				}
+
+				default: // ", \ or /
+					s += c;
+					break;
+			}
+		}
+
+		return s;
+	}
+
+	constexpr bool cmp(std::string_view str) const {
+		if (sv.find('\\') != std::string_view::npos)
+			return decode() == str;
+
+		return sv == str;
+	}
+
+private:
+	static constexpr unsigned int hex_value(std::string_view s) {
+		unsigned int v = 0;
+
+		for (auto c : s) {
+			v <<= 4;
+
+			if (c >= '0' && c <= '9')
+				v |= (unsigned int)(c - '0');
+			else if (c >= 'a' && c <= 'f')
+				v |= (unsigned int)(c - 'a' + 10);
+			else
+				v |= (unsigned int)(c - 'A' + 10);
+		}
+
+		return v;
+	}
+
+	static constexpr void append_utf8(std::string& s, uint32_t c) {
+		if (c < 0x80)
+			s += (char)c;
+		else if (c < 0x800) {
+			s += (char)(0xc0 | (c >> 6));
+			s += (char)(0x80 | (c & 0x3f));
+		} else if (c < 0x10000) {
+			s += (char)(0xe0 | (c >> 12));
+			s += (char)(0x80 | ((c >> 6) & 0x3f));
+			s += (char)(0x80 | (c & 0x3f));
+		} else {
+			s += (char)(0xf0 | (c >> 18));
+			s += (char)(0x80 | ((c >> 12) & 0x3f));
+			s += (char)(0x80 | ((c >> 6) & 0x3f));
+			s += (char)(0x80 | (c & 0x3f));
+		}
+	}
+
+	std::string_view sv;
+};
+
+// Appends the value r is on to s, without whitespace, and leaves r on its
+// last node. If r is on a key, it's the key's value that's copied.
+template<typename R>
+constexpr void json_copy(R& r, std::string& s) {
+	bool comma = false;
+
+	if (r.node_type() == json_node::key)
+		r.read();
+
+	s += r.raw();
+
+	if (r.node_type() != json_node::object && r.node_type() != json_node::array)
+		return;
+
+	auto d = r.depth();
+
+	do {
+		r.read();
+
+		switch (r.node_type()) {
+			case json_node::end_object:
+			case json_node::end_array:
+				s += r.raw();
+				comma = true;
+				break;
+
+			case json_node::key:
+				if (comma)
+					s += ",";
+
+				s += r.raw();
+				s += ":";
+				comma = false;
+				break;
+
+			case json_node::object:
+			case json_node::array:
+				if (comma)
+					s += ",";
+
+				s += r.raw();
+				comma = false;
+				break;
+
+			default:
+				if (comma)
+					s += ",";
+
+				s += r.raw();
+				comma = true;
+				break;
+		}
+	} while (r.depth() >= d);
+}
+
+class json_reader {
+public:
+	constexpr json_reader(std::string_view sv) : sv(sv) { }
+	json_reader(input_source& source) : source(&source), eof(false) { }
+
+	constexpr bool read() {
+		while (true) {
+			auto start = sv;
+
+			skip_whitespace();
+
+			if (sv.empty() && eof) {
+				if (expect == json_expect::done)
+					return false;
+
+				throw std::runtime_error("Unexpected end of JSON.");
+			}
+
+			if (!sv.empty() && next_token())
+				return true;
+
+			sv = start;
+
+			if (!more())
+				eof = true;
+		}
+	}
+
+	constexpr enum json_node node_type() const {
+		return type;
+	}
+
+	constexpr std::string_view raw() const {
+		return node;
+	}
+
+	constexpr size_t depth() const {
+		return stack.length();
+	}
+
+	// If it's reading from an input_source, what raw() and string_value()
+	// return only lasts until the next read().
+	constexpr bool streaming() const {
+		return source;
+	}
+
+	// the contents of a key or string, without the quotes
+	constexpr json_enc_string_view string_value() const {
+		if (type != json_node::key && type != json_node::string)
+			return {};
+
+		return node.substr(1, node.length() - 2);
+	}
+
+	// Skips the value following a key, or the rest of an object or array
+	// whose opening has just been read.
+	constexpr void skip() {
+		if (type == json_node::key)
+			read();
+
+		if (type != json_node::object && type != json_node::array)
+			return;
+
+		auto d = depth();
+
+		do {
+			read();
+		} while (depth() >= d);
+	}
+
+	// Like skip(), but appends what was skipped to s, without whitespace.
+	constexpr void copy(std::string& s) {
+		json_copy(*this, s);
+	}
+
+private:
+	enum class json_expect {
+		value,
+		first_value,
+		first_key,
+		comma,
+		done
+	};
+
+	static constexpr bool __inline is_whitespace(char c) {
+		return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+	}
+
+	static constexpr bool __inline is_digit(char c) {
+		return c >= '0' && c <= '9';
+	}
+
+	static constexpr bool __inline is_hex(char c) {
+		return is_digit(c) || (c >= 'a' && c <= 'f') || (c >= 'A' && c <= 'F');
+	}
+
+	static constexpr unsigned int hex_value(std::string_view s) {
+		unsigned int v = 0;
+
+		for (auto c : s) {
+			v <<= 4;
+
+			if (is_digit(c))
+				v |= (unsigned int)(c - '0');
+			else if (c >= 'a' && c <= 'f')
+				v |= (unsigned int)(c - 'a' + 10);
+			else
+				v |= (unsigned int)(c - 'A' + 10);
+		}
+
+		return v;
+	}
+
+	// Returns false if the token runs past the end of the buffer, in which case
+	// read() fetches more input and tries again.
+	constexpr bool next_token() {
+		switch (expect) {
+			case json_expect::done:
+				throw std::runtime_error("Trailing characters after JSON.");
+
+			case json_expect::comma:
+				if (sv.front() != ',')
+					return close();
+
+				sv.remove_prefix(1);
+				skip_whitespace();
+
+				if (!need(1))
+					return false;
+
+				if (stack.back() == '{')
+					return read_key();
+
+				return read_value();
+
+			case json_expect::first_key:
+				if (sv.front() == '}')
+					return close();
+
+				return read_key();
+
+			case json_expect::first_value:
+				if (sv.front() == ']')
+					return close();
+
+				return read_value();
+
+			default:
+				return read_value();
+		}
+	}
+
+	// Moves the unread part of the buffer to the front, and appends the next chunk.
+	constexpr bool more() {
+		if (!source)
+			return false;
+
+		auto keep = sv.length();
+
+		if (keep == 0)
+			buf.clear();
+		else if (sv.data() != buf.data())
+			buf.erase(0, (size_t)(sv.data() - buf.data()));
+
+		// A token that runs on past the buffer is scanned again from its start
+		// once more has been read, so while one is pending read as much again
+		// as is kept: each byte is then scanned a bounded number of times.
+		auto want = keep + (keep > input_source::chunk_size ? keep : input_source::chunk_size);
+
+		buf.resize_and_overwrite(want, [&](char* p, size_t n) {
+			return keep + source->read(p + keep, n - keep);
+		});
+
+		sv = buf;
+
+		return buf.length() > keep;
+	}
+
+	constexpr bool need(size_t len) const {
+		if (sv.length() >= len)
+			return true;
+
+		if (eof)
+			throw std::runtime_error("Unexpected end of JSON.");
+
+		return false;
+	}
+
+	constexpr void skip_whitespace() {
+		while (!sv.empty() && is_whitespace(sv.front())) {
+			sv.remove_prefix(1);
+		}
+	}
+
+	constexpr void after_value() {
+		expect = stack.empty() ? json_expect::done : json_expect::comma;
+	}
+
+	constexpr bool close() {
+		auto c = sv.front();
+
+		if (stack.empty() || (c != '}' && c != ']') || (c == '}') != (stack.back() == '{'))
+			throw std::runtime_error("Malformed JSON.");
+
+		node = sv.substr(0, 1);
+		sv.remove_prefix(1);
+		stack.pop_back();
+
+		type = c == '}' ? json_node::end_object : json_node::end_array;
+		after_value();
+
+		return true;
+	}
+
+	static constexpr size_t npos = std::string_view::npos;
+
+	// Returns npos if the string runs past the end of the buffer.
+	constexpr size_t string_length() const {
+		size_t i = 1;
+
+		while (true) {
+			if (!need(i + 1))
+				return npos;
+
+			auto c = sv[i];
+
+			if (c == '"')
+				return i + 1;
+
+			if ((unsigned char)c < 0x20)
+				throw std::runtime_error("Control character in string.");
+
+			if (c != '\\') {
+				i++;
+				continue;
+			}
+
+			if (!need(i + 2))
+				return npos;
+
+			switch (sv[i + 1]) {
+				case '"':
+				case '\\':
+				case '/':
+				case 'b':
+				case 'f':
+				case 'n':
+				case 'r':
+				case 't':
+					i += 2;
+					break;
+
+				case 'u': {
+					if (!need(i + 6))
+						return npos;
+
+					auto cp = escaped_code_unit(i);
+
+					i += 6;
+
+					if (cp >= 0xdc00 && cp <= 0xdfff)
+						throw std::runtime_error("Unpaired surrogate in string.");
+
+					if (cp >= 0xd800 && cp <= 0xdbff) {
+						if (!need(i + 6))
+							return npos;
+
+						if (sv[i] != '\\' || sv[i + 1] != 'u')
+							throw std::runtime_error("Unpaired surrogate in string.");
+
+						cp = escaped_code_unit(i);
+
+						if (cp < 0xdc00 || cp > 0xdfff)
+							throw std::runtime_error("Unpaired surrogate in string.");
+
+						i += 6;
+					}
+
+					break;
+				}
+
+				default:
+					throw std::runtime_error("Invalid escape sequence.");
+			}
+		}
+	}
+
+	constexpr unsigned int escaped_code_unit(size_t pos) const {
+		auto hex = sv.substr(pos + 2, 4);
+
+		for (auto c : hex) {
+			if (!is_hex(c))
+				throw std::runtime_error("Invalid escape sequence.");
+		}
+
+		return hex_value(hex);
+	}
+
+	// Returns npos if the number might carry on past the end of the buffer.
+	constexpr size_t number_length() const {
+		size_t i = 0;
+
+		auto digits = [&]() {
+			if (!need(i + 1))
+				return false;
+
+			if (!is_digit(sv[i]))
+				throw std::runtime_error("Malformed number.");
+
+			while (i < sv.length() && is_digit(sv[i])) {
+				i++;
+			}
+
+			return true;
+		};
+
+		if (sv[i] == '-')
+			i++;
+
+		if (!need(i + 1))
+			return npos;
+
+		if (sv[i] == '0')
+			i++;
+		else if (!digits())
+			return npos;
+
+		if (i < sv.length() && sv[i] == '.') {
+			i++;
+
+			if (!digits())
+				return npos;
+		}
+
+		if (i < sv.length() && (sv[i] == 'e' || sv[i] == 'E')) {
+			i++;
+
+			if (!need(i + 1))
+				return npos;
+
+			if (sv[i] == '+' || sv[i] == '-')
+				i++;
+
+			if (!digits())
+				return npos;
+		}
+
+		if (i == sv.length() && !eof)
+			return npos;
+
+		return i;
+	}
+
+	constexpr bool read_key() {
+		if (sv.front() != '"')
+			throw std::runtime_error("Expected object key.");
+
+		auto len = string_length();
+
+		if (len == npos)
+			return false;
+
+		node = sv.substr(0, len);
+		sv.remove_prefix(len);
+
+		skip_whitespace();
+
+		if (!need(1))
+			return false;
+
+		if (sv.front() != ':')
+			throw std::runtime_error("Expected colon after object key.");
+
+		sv.remove_prefix(1);
+
+		type = json_node::key;
+		expect = json_expect::value;
+
+		return true;
+	}
+
+	constexpr bool read_value() {
+		size_t len;
+
+		switch (sv.front()) {
+			case '{':
+			case '[':
+				node = sv.substr(0, 1);
+				sv.remove_prefix(1);
+				stack.push_back(node.front());
+
+				if (node.front() == '{') {
+					type = json_node::object;
+					expect = json_expect::first_key;
+				} else {
+					type = json_node::array;
+					expect = json_expect::first_value;
+				}
+
+				return true;
+
+			case '"':
+				len = string_length();
+				type = json_node::string;
+				break;
+
+			case 't':
+				if (!need(4))
+					return false;
+
+				if (!sv.starts_with("true"))
+					throw std::runtime_error("Malformed JSON.");
+
+				len = 4;
+				type = json_node::boolean;
+				break;
+
+			case 'f':
+				if (!need(5))
+					return false;
+
+				if (!sv.starts_with("false"))
+					throw std::runtime_error("Malformed JSON.");
+
+				len = 5;
+				type = json_node::boolean;
+				break;
+
+			case 'n':
+				if (!need(4))
+					return false;
+
+				if (!sv.starts_with("null"))
+					throw std::runtime_error("Malformed JSON.");
+
+				len = 4;
+				type = json_node::null;
+				break;
+
+			default:
+				len = number_length();
+				type = json_node::number;
+				break;
+		}
+
+		if (len == npos)
+			return false;
+
+		node = sv.substr(0, len);
+		sv.remove_prefix(len);
+		after_value();
+
+		return true;
+	}
+
+	std::string_view sv, node;
+	enum json_node type = json_node::none;
+	enum json_expect expect = json_expect::value;
+	std::string stack;
+	input_source* source = nullptr;
+	bool eof = true;
+	std::string buf;
+};
+
+// Reads the array element that starts at the current node, and copies into
+// value the member called key. If key is empty, it's set to the first key of
+// the element, in the way that JSON_ARRAY and STRING_AGG have always chosen it.
+bool select_member(json_reader& r, std::string& key, std::string& value);
+
+// One step of a path such as $.a."b c"[2] - either a member name or an array index.
+struct json_path_step {
+	std::string name;
+	std::optional<size_t> index;
+};
+
+using json_path = std::vector<json_path_step>;
+
+// json-path.cpp
+json_path parse_json_path(std::string_view sv);
+bool find_path(json_reader& r, const json_path& path);
+
+// A hash of a document that ignores whitespace, the order of object members,
+// and how numbers and strings are written - see JSON_HASH.
+struct json_hash {
+	uint64_t lo, hi;
+
+	constexpr bool operator==(const json_hash&) const = default;
+};
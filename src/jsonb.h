@@ -0,0 +1,361 @@
+#pragma once
+
+#include <cstdint>
+#include <utility>
+#include "json.h"
+
+// The binary form JSON_BINARY converts JSON to, for storing in a VARBINARY
+// column so that it can be read again without being parsed. After the magic
+// number comes the value:
+//
+// - A scalar is a byte with its type in the low nibble, and the length of its
+//   text in the high nibble, or 15 if the length follows as a varint. Then
+//   comes the text as it was in the JSON, with any quotes and escapes.
+// - An object or array is a byte with its type in the low nibble, and in the
+//   high nibble 0, 1 or 2 for a width of 1, 2 or 4 bytes. Then its total size
+//   and its number of members or elements, as little-endian integers of that
+//   width. Then its contents, and then the index: the offset from the start of
+//   the contents of each element, or of each member's key in key order, again
+//   of that width.
+//
+// Members are kept in the order they were in, so that converting back to text
+// gives the same JSON without its whitespace.
+enum class jsonb_type : uint8_t {
+	null,
+	false_value,
+	true_value,
+	number,
+	string,
+	escaped_string,
+	array,
+	object
+};
+
+static constexpr std::string_view jsonb_magic = "JSB\x01";
+
+// Reads binary JSON in the same way that json_reader reads text, so that the
+// same functions can run on either. An object or array whose opening has just
+// been read can also be jumped into using its index.
+class jsonb_reader {
+public:
+	constexpr jsonb_reader(std::string_view sv) : sv(sv) {
+		if (!sv.starts_with(jsonb_magic))
+			throw std::runtime_error("Not binary JSON.");
+
+		pos = jsonb_magic.length();
+	}
+
+	constexpr bool read() {
+		if (stack.empty()) {
+			if (started) {
+				if (pos != sv.length())
+					throw std::runtime_error("Trailing data after binary JSON.");
+
+				return false;
+			}
+
+			started = true;
+		} else if (pos == stack.back().body_end) {
+			auto& c = stack.back();
+
+			if (c.object && !c.key_next)
+				malformed();
+
+			type = c.object ? json_node::end_object : json_node::end_array;
+			node = c.object ? "}" : "]";
+			pos = c.end;
+			stack.pop_back();
+
+			return true;
+		}
+
+		auto limit = stack.empty() ? sv.length() : stack.back().body_end;
+		bool is_key = false;
+
+		if (pos >= limit)
+			malformed();
+
+		if (!stack.empty() && stack.back().object) {
+			is_key = stack.back().key_next;
+			stack.back().key_next = !is_key;
+		}
+
+		auto b = (uint8_t)sv[pos];
+		auto t = (jsonb_type)(b & 0xf);
+
+		if (is_key && t != jsonb_type::string && t != jsonb_type::escaped_string)
+			malformed();
+
+		if (t == jsonb_type::object || t == jsonb_type::array) {
+			open(limit);
+			return true;
+		}
+
+		node = scalar(pos, limit);
+
+		switch (t) {
+			case jsonb_type::null:
+				type = json_node::null;
+				break;
+
+			case jsonb_type::false_value:
+			case jsonb_type::true_value:
+				type = json_node::boolean;
+				break;
+
+			case jsonb_type::number:
+				type = json_node::number;
+				break;
+
+			case jsonb_type::string:
+			case jsonb_type::escaped_string:
+				if (!quoted(node))
+					malformed();
+
+				type = is_key ? json_node::key : json_node::string;
+				break;
+
+			default:
+				malformed();
+		}
+
+		return true;
+	}
+
+	constexpr enum json_node node_type() const {
+		return type;
+	}
+
+	constexpr std::string_view raw() const {
+		return node;
+	}
+
+	constexpr size_t depth() const {
+		return stack.size();
+	}
+
+	constexpr json_enc_string_view string_value() const {
+		if (type != json_node::key && type != json_node::string)
+			return {};
+
+		return node.substr(1, node.length() - 2);
+	}
+
+	// As with json_reader, but the contents of an object or array are jumped
+	// over rather than read.
+	constexpr void skip() {
+		if (type == json_node::key)
+			read();
+
+		if (type != json_node::object && type != json_node::array)
+			return;
+
+		seek_end();
+		read();
+	}
+
+	constexpr void copy(std::string& s) {
+		json_copy(*this, s);
+	}
+
+	// The number of members or elements of the object or array whose opening
+	// has just been read.
+	constexpr size_t size() const {
+		return stack.back().count;
+	}
+
+	// Moves to the i-th element of the array whose opening has just been read,
+	// or to the member of the object whose key is i-th in sorted order, so that
+	// it's what read() returns next.
+	constexpr void seek(size_t i) {
+		auto& c = stack.back();
+
+		if (i >= c.count)
+			throw std::out_of_range("Index out of range.");
+
+		pos = c.body + entry(i);
+		c.key_next = true;
+	}
+
+	// Moves to the end of the innermost object or array, so that read()
+	// returns its closing.
+	constexpr void seek_end() {
+		auto& c = stack.back();
+
+		pos = c.body_end;
+		c.key_next = true;
+	}
+
+	// The key of the object whose opening has just been read that's i-th in
+	// sorted order.
+	constexpr std::string key(size_t i) const {
+		auto [k, escaped] = key_at(i);
+
+		if (escaped)
+			return json_enc_string_view{k}.decode();
+
+		return std::string{k};
+	}
+
+	// The range of sorted positions of the members of the object whose opening
+	// has just been read that are called name. Where there's more than one,
+	// they're in the order they were in the JSON.
+	constexpr std::pair<size_t, size_t> find(std::string_view name) const {
+		auto cmp = [&](size_t i) {
+			auto [k, escaped] = key_at(i);
+
+			if (escaped)
+				return json_enc_string_view{k}.decode().compare(name);
+
+			return k.compare(name);
+		};
+
+		size_t lo = 0, hi = stack.back().count;
+
+		while (lo < hi) {
+			auto mid = lo + (hi - lo) / 2;
+
+			if (cmp(mid) < 0)
+				lo = mid + 1;
+			else
+				hi = mid;
+		}
+
+		auto first = lo;
+
+		hi = stack.back().count;
+
+		while (lo < hi) {
+			auto mid = lo + (hi - lo) / 2;
+
+			if (cmp(mid) <= 0)
+				lo = mid + 1;
+			else
+				hi = mid;
+		}
+
+		return {first, lo};
+	}
+
+private:
+	struct container {
+		size_t body;
+		size_t body_end;
+		size_t end;
+		size_t count;
+		size_t width;
+		bool object;
+		bool key_next;
+	};
+
+	[[noreturn]] static void malformed() {
+		throw std::runtime_error("Malformed binary JSON.");
+	}
+
+	constexpr size_t read_uint(size_t off, size_t width) const {
+		size_t v = 0;
+
+		for (size_t i = 0; i < width; i++) {
+			v |= (size_t)(uint8_t)sv[off + i] << (i * 8);
+		}
+
+		return v;
+	}
+
+	// Reads the header and text of the scalar at p, and moves p past it.
+	constexpr std::string_view scalar(size_t& p, size_t limit) const {
+		size_t len = (uint8_t)sv[p] >> 4;
+
+		p++;
+
+		if (len == 15) {
+			len = 0;
+
+			for (unsigned int shift = 0; ; shift += 7) {
+				if (p >= limit || shift >= 35)
+					malformed();
+
+				auto b = (uint8_t)sv[p];
+
+				p++;
+				len |= (size_t)(b & 0x7f) << shift;
+
+				if (!(b & 0x80))
+					break;
+			}
+		}
+
+		if (len > limit - p)
+			malformed();
+
+		auto text = sv.substr(p, len);
+
+		p += len;
+
+		return text;
+	}
+
+	static constexpr bool quoted(std::string_view text) {
+		return text.length() >= 2 && text.front() == '"' && text.back() == '"';
+	}
+
+	constexpr void open(size_t limit) {
+		auto b = (uint8_t)sv[pos];
+
+		if ((b >> 4) > 2)
+			malformed();
+
+		auto width = (size_t)1 << (b >> 4);
+		auto header = 1 + (2 * width);
+
+		if (limit - pos < header)
+			malformed();
+
+		auto size = read_uint(pos + 1, width);
+		auto count = read_uint(pos + 1 + width, width);
+
+		if (size < header || size > limit - pos || count > (size - header) / width)
+			malformed();
+
+		auto obj = (jsonb_type)(b & 0xf) == jsonb_type::object;
+
+		stack.push_back({pos + header, pos + size - (count * width), pos + size, count, width, obj, true});
+
+		type = obj ? json_node::object : json_node::array;
+		node = obj ? "{" : "[";
+		pos += header;
+	}
+
+	constexpr size_t entry(size_t i) const {
+		auto& c = stack.back();
+		auto off = read_uint(c.body_end + (i * c.width), c.width);
+
+		if (off >= c.body_end - c.body)
+			malformed();
+
+		return off;
+	}
+
+	// the text of a key in the index, without its quotes, and whether it has escapes
+	constexpr std::pair<std::string_view, bool> key_at(size_t i) const {
+		auto& c = stack.back();
+		auto p = c.body + entry(i);
+		auto t = (jsonb_type)((uint8_t)sv[p] & 0xf);
+		auto text = scalar(p, c.body_end);
+
+		if ((t != jsonb_type::string && t != jsonb_type::escaped_string) || !quoted(text))
+			malformed();
+
+		return {text.substr(1, text.length() - 2), t == jsonb_type::escaped_string};
+	}
+
+	std::string_view sv, node;
+	size_t pos;
+	enum json_node type = json_node::none;
+	std::vector<container> stack;
+	bool started = false;
+};
+
+// json-binary.cpp
+bool select_member(jsonb_reader& r, std::string& key, std::string& value);
+std::string jsonb_from_json(json_reader& r, size_t size_hint);
@@ -1,133 +1,435 @@
 #include "jsonfunc.h"
 #include <stdexcept>
-#include <sstream>
+#include <cassert>
 #include <nlohmann/json.hpp>
 #include "git.h"
 #include "xml.h"
-
-using json = nlohmann::json;
+#include "json.h"
+#include "jsonb.h"
+#include "arena.h"
+#include "cache.h"
+#include "thread-pool.h"
+#include "compress.h"
+
+// Values are only built to be reserialized, so they're allocated from the
+// thread's arena, and freed all at once when the arena_scope around them ends.
+using arena_string = std::basic_string<char, std::char_traits<char>, arena_allocator<char>>;
+using json = nlohmann::basic_json<std::map, std::vector, arena_string, bool, int64_t, uint64_t, double, arena_allocator>;
 
 using namespace std;
 
-string utf16_to_utf8(u16string_view ws) {
-	int len;
-	string s;
+// Lets nlohmann's serializer write straight into a utf8_writer, rather than
+// building a string for dump() to return.
+class writer_adapter : public nlohmann::detail::output_adapter_protocol<char> {
+public:
+	writer_adapter(utf8_writer& w) : w(w) { }
+
+	void write_character(char c) override {
+		w += c;
+	}
+
+	void write_characters(const char* s, size_t length) override {
+		w += string_view(s, length);
+	}
+
+private:
+	utf8_writer& w;
+};
+
+using json_serializer = nlohmann::detail::serializer<json>;
+
+static string_view as_bytes(u16string_view ws) {
+	return string_view((const char*)ws.data(), ws.length() * sizeof(char16_t));
+}
+
+// Calls f with a reader for the JSON in input, which is UTF-16 if utf16 is set
+// and UTF-8 otherwise. If the document cache is on, the reader is for the binary
+// form of the document that the cache keeps, which it's parsed into the first
+// time it's seen - so every function called on the same document shares it.
+template<typename F>
+static void cached(string_view input, bool utf16, F&& f) {
+	auto& cache = document_cache::get();
+
+	auto parse = [&](auto&& g) {
+		if (utf16) {
+			utf16_source src(u16string_view((const char16_t*)input.data(), input.length() / sizeof(char16_t)));
+			json_reader r(src);
+
+			g(r);
+		} else {
+			json_reader r(input);
 
-	if (ws.empty())
-		return "";
+			g(r);
+		}
+	};
 
-	len = WideCharToMultiByte(CP_UTF8, 0, (WCHAR*)ws.data(), (int)ws.length(), NULL, 0, NULL, NULL);
+	if (!cache.enabled()) {
+		parse(f);
+		return;
+	}
 
-	if (len == 0)
-		return "";
+	auto doc = cache.find(input, utf16);
 
-	s = string(len, ' ');
+	if (!doc) {
+		parse([&](json_reader& r) {
+			doc = cache.insert(input, utf16, jsonb_from_json(r, input.length()));
+		});
+	}
 
-    WideCharToMultiByte(CP_UTF8, 0, (WCHAR*)ws.data(), (int)ws.length(), (char*)s.c_str(), len, NULL, NULL);
+	jsonb_reader r(*doc);
 
-	return s;
+	f(r);
 }
 
-u16string utf8_to_utf16(string_view s) {
-	int len;
-	u16string wstr;
+// For the versions of the functions that read the binary form from
+// JSON_BINARY, which return UTF-16, or UTF-8 for the _U8 versions.
+template<typename F>
+static BSTR from_binary(const char* in, UINT len, bool u8, F&& f) {
+	jsonb_reader r(string_view(in, len));
+	utf8_writer s;
 
-	if (s == "")
-		return u"";
+	f(r, s);
 
-	len = MultiByteToWideChar(CP_UTF8, 0, s.data(), (int)s.length(), NULL, 0);
+	return u8 ? bstr_u8(s.str()) : bstr(s.str());
+}
 
-	if (len == 0)
-		return u"";
+// W is utf8_writer, or gzip_writer for JSON_PRETTY_COMPRESS.
+template<typename R, typename W>
+static constexpr void json_pretty(R& r, W& s) {
+	bool first = false, after_key = false;
 
-	wstr = u16string(len, ' ');
+	auto newline = [&](size_t depth) {
+		s += "\n";
+		s.append(depth * 3, ' ');
+	};
 
-	MultiByteToWideChar(CP_UTF8, 0, s.data(), (int)s.length(), (WCHAR*)wstr.c_str(), len);
+	while (r.read()) {
+		switch (r.node_type()) {
+			case json_node::end_object:
+			case json_node::end_array:
+				if (!first)
+					newline(r.depth());
 
-	return wstr;
+				s += r.raw();
+				first = false;
+				break;
+
+			default: {
+				auto opening = r.node_type() == json_node::object || r.node_type() == json_node::array;
+				auto depth = opening ? r.depth() - 1 : r.depth();
+
+				if (after_key)
+					after_key = false;
+				else if (first)
+					newline(depth);
+				else if (depth > 0) {
+					s += ",";
+					newline(depth);
+				}
+
+				s += r.raw();
+				first = opening;
+
+				if (r.node_type() == json_node::key) {
+					s += ": ";
+					after_key = true;
+				}
+
+				break;
+			}
+		}
+	}
 }
 
+static constexpr string json_pretty(string_view in) {
+	json_reader r(in);
+	utf8_writer s;
+
+	s.reserve(in.length());
+	json_pretty(r, s);
+
+	return string{s.str()};
+}
+
+static_assert(json_pretty("{\"a\":[1,2],\"b\":{}}") == R"({
+   "a": [
+      1,
+      2
+   ],
+   "b": {}
+})");
+static_assert(json_pretty("[]") == "[]");
+static_assert(json_pretty(" [ [ ] , { } ] ") == "[\n   [],\n   {}\n]");
+static_assert(json_pretty("\"text\"") == "\"text\"");
+static_assert(json_pretty("-1.50e+10") == "-1.50e+10");
+static_assert(json_pretty("{\"z\":true,\"a\":null,\"m\":false}") == "{\n   \"z\": true,\n   \"a\": null,\n   \"m\": false\n}");
+static_assert(json_pretty("[\"\\u00e9\\\"\\ud83d\\ude00\"]") == "[\n   \"\\u00e9\\\"\\ud83d\\ude00\"\n]");
+static_assert(json_pretty("{\"a\":{\"b\":{\"c\":[{}]}}}") == R"({
+   "a": {
+      "b": {
+         "c": [
+            {}
+         ]
+      }
+   }
+})");
+
 extern "C" __declspec(dllexport) BSTR JSON_PRETTY(WCHAR* in) noexcept {
-	u16string ws;
+	if (!in)
+		return nullptr;
+
+	try {
+		u16string_view inw = (char16_t*)in;
+		utf8_writer s;
+
+		cached(as_bytes(inw), true, [&](auto& r) {
+			s.reserve(inw.length());
+			json_pretty(r, s);
+		});
+
+		return bstr(s.str());
+	} catch (...) {
+		return nullptr;
+	}
+}
 
+extern "C" __declspec(dllexport) BSTR JSON_PRETTY_U8(const char* in, UINT len) noexcept {
 	if (!in)
 		return nullptr;
 
 	try {
-		auto j = json::parse(utf16_to_utf8((char16_t*)in));
+		string_view sv(in, len);
+		utf8_writer s;
 
-		string s = j.dump(3);
+		cached(sv, false, [&](auto& r) {
+			s.reserve(len);
+			json_pretty(r, s);
+		});
 
-		ws = utf8_to_utf16(s);
+		return bstr_u8(s.str());
 	} catch (...) {
 		return nullptr;
 	}
+}
+
+extern "C" __declspec(dllexport) BSTR JSON_PRETTY_BINARY(const char* in, UINT len) noexcept {
+	if (!in)
+		return nullptr;
 
-	return bstr(ws);
+	try {
+		return from_binary(in, len, false, [&](jsonb_reader& r, utf8_writer& s) {
+			s.reserve(len * 2);
+			json_pretty(r, s);
+		});
+	} catch (...) {
+		return nullptr;
+	}
 }
 
-extern "C" __declspec(dllexport) BSTR JSON_ARRAY(WCHAR* in) noexcept {
-	json j;
+extern "C" __declspec(dllexport) BSTR JSON_PRETTY_BINARY_U8(const char* in, UINT len) noexcept {
+	if (!in)
+		return nullptr;
 
+	try {
+		return from_binary(in, len, true, [&](jsonb_reader& r, utf8_writer& s) {
+			s.reserve(len * 2);
+			json_pretty(r, s);
+		});
+	} catch (...) {
+		return nullptr;
+	}
+}
+
+extern "C" __declspec(dllexport) BSTR JSON_PRETTY_DECOMPRESS(const char* in, UINT len) noexcept {
 	if (!in)
-		return bstr(u"[]");
+		return nullptr;
 
 	try {
-		j = json::parse(utf16_to_utf8((char16_t*)in));
+		return from_compressed(in, len, compressed_output::utf16, [&](input_source& src, auto& s) {
+			json_reader r(src);
+
+			json_pretty(r, s);
+		});
 	} catch (...) {
 		return nullptr;
 	}
+}
 
-	if (j.type() != json::value_t::array)
+extern "C" __declspec(dllexport) BSTR JSON_PRETTY_DECOMPRESS_U8(const char* in, UINT len) noexcept {
+	if (!in)
 		return nullptr;
 
-	u16string ws;
+	try {
+		return from_compressed(in, len, compressed_output::utf8, [&](input_source& src, auto& s) {
+			json_reader r(src);
+
+			json_pretty(r, s);
+		});
+	} catch (...) {
+		return nullptr;
+	}
+}
+
+extern "C" __declspec(dllexport) BSTR JSON_PRETTY_COMPRESS(const char* in, UINT len) noexcept {
+	if (!in)
+		return nullptr;
 
 	try {
-		json ret{json::array()};
-		string sv;
+		return from_compressed(in, len, compressed_output::gzip, [&](input_source& src, auto& s) {
+			json_reader r(src);
 
-		for (const auto& el : j) {
-			if (sv.empty()) {
-				if (!el.empty())
-					sv = el.items().begin().key();
-			}
+			json_pretty(r, s);
+		});
+	} catch (...) {
+		return nullptr;
+	}
+}
 
-			if (!sv.empty() && el.count(sv) > 0)
-				ret.emplace_back(el[sv]);
-			else
-				ret.emplace_back(nullptr);
-		}
+// Only the member that's picked out of each element is parsed into a json
+// value, so that it's re-serialized the same way as before - everything else
+// is skipped over by the reader.
+template<typename R>
+static void json_array2(R& r, utf8_writer& s) {
+	if (!r.read() || r.node_type() != json_node::array)
+		throw runtime_error("Not an array.");
+
+	// the serializer's indent string is from the arena too
+	arena_scope outer;
+	json_serializer ser(make_shared<writer_adapter>(s), ' ');
+	string sv, value;
+
+	// the result has always started with an empty array, as the old
+	// json ret{json::array()} was taken as an initializer list
+	s += "[[]";
 
-		string s = ret.dump();
+	while (r.read() && r.node_type() != json_node::end_array) {
+		s += ",";
+
+		if (select_member(r, sv, value) && !sv.empty()) {
+			arena_scope scope;
+
+			ser.dump(json::parse(value), false, false, 0);
+		} else
+			s += "null";
+	}
+
+	if (r.read())
+		throw runtime_error("Trailing characters after JSON.");
+
+	s += "]";
+}
 
-		ws = utf8_to_utf16(s);
+template<typename R>
+static void json_array(R& r, utf8_writer& s) {
+	json_array2(r, s);
+
+	// anything left behind would be leaked, and would stop the arena from
+	// ever giving its chunks back
+	assert(arena::get().empty());
+}
+
+extern "C" __declspec(dllexport) BSTR JSON_ARRAY(WCHAR* in) noexcept {
+	if (!in)
+		return bstr(u"[]");
+
+	try {
+		u16string_view inw = (char16_t*)in;
+		utf8_writer s;
+
+		cached(as_bytes(inw), true, [&](auto& r) {
+			json_array(r, s);
+		});
+
+		return bstr(s.str());
 	} catch (...) {
 		return nullptr;
 	}
+}
 
-	return bstr(ws);
+extern "C" __declspec(dllexport) BSTR JSON_ARRAY_U8(const char* in, UINT len) noexcept {
+	if (!in)
+		return bstr_u8("[]");
+
+	try {
+		string_view sv(in, len);
+		utf8_writer s;
+
+		cached(sv, false, [&](auto& r) {
+			json_array(r, s);
+		});
+
+		return bstr_u8(s.str());
+	} catch (...) {
+		return nullptr;
+	}
+}
+
+extern "C" __declspec(dllexport) BSTR JSON_ARRAY_BINARY(const char* in, UINT len) noexcept {
+	if (!in)
+		return bstr(u"[]");
+
+	try {
+		return from_binary(in, len, false, [&](jsonb_reader& r, utf8_writer& s) {
+			json_array(r, s);
+		});
+	} catch (...) {
+		return nullptr;
+	}
+}
+
+extern "C" __declspec(dllexport) BSTR JSON_ARRAY_BINARY_U8(const char* in, UINT len) noexcept {
+	if (!in)
+		return bstr_u8("[]");
+
+	try {
+		return from_binary(in, len, true, [&](jsonb_reader& r, utf8_writer& s) {
+			json_array(r, s);
+		});
+	} catch (...) {
+		return nullptr;
+	}
+}
+
+static string read_git_file(string_view repodir, string_view fn) {
+	GitRepo repo(string{repodir});
+
+	GitTree tree(repo, "HEAD");
+
+	GitBlob blob(tree, string{fn});
+
+	return blob;
 }
 
 extern "C" __declspec(dllexport) BSTR git_file(WCHAR* repodirw, WCHAR* fnw) noexcept {
-	u16string ws;
+	BSTR ret;
 
 	git_libgit2_init();
 
 	try {
 		auto repodir = utf16_to_utf8((char16_t*)repodirw);
 		auto fn = utf16_to_utf8((char16_t*)fnw);
-		string s;
 
-		GitRepo repo(repodir);
+		ret = bstr(read_git_file(repodir, fn));
+	} catch (...) {
+		git_libgit2_shutdown();
+		return nullptr;
+	}
 
-		GitTree tree(repo, "HEAD");
+	git_libgit2_shutdown();
 
-		GitBlob blob(tree, fn);
+	return ret;
+}
+
+extern "C" __declspec(dllexport) BSTR git_file_U8(const char* repodir, UINT repodirlen, const char* fn, UINT fnlen) noexcept {
+	BSTR ret;
+
+	if (!repodir || !fn)
+		return nullptr;
 
-		s = blob;
+	git_libgit2_init();
 
-        ws = utf8_to_utf16(s);
+	try {
+		ret = bstr_u8(read_git_file(string_view(repodir, repodirlen), string_view(fn, fnlen)));
 	} catch (...) {
 		git_libgit2_shutdown();
 		return nullptr;
@@ -135,52 +437,564 @@ extern "C" __declspec(dllexport) BSTR git_file(WCHAR* repodirw, WCHAR* fnw) noex
 
 	git_libgit2_shutdown();
 
-	return bstr(ws);
+	return ret;
+}
+
+// Integers are the same whether they're copied or reserialized, provided they
+// don't overflow and aren't -0.
+static constexpr bool is_canonical_integer(string_view v) {
+	auto digits = v.front() == '-' ? v.substr(1) : v;
+
+	if (digits.empty() || digits.length() > 18 || (digits.front() == '0' && v.length() > 1))
+		return false;
+
+	for (auto c : digits) {
+		if (c < '0' || c > '9')
+			return false;
+	}
+
+	return true;
+}
+
+static_assert(is_canonical_integer("0"));
+static_assert(is_canonical_integer("-12"));
+static_assert(!is_canonical_integer("-0"));
+static_assert(!is_canonical_integer("1.0"));
+static_assert(!is_canonical_integer("1e2"));
+static_assert(!is_canonical_integer("1234567890123456789"));
+
+// Copies the value as it appears in the source where that's what dump() would
+// have produced anyway, so that only floats, containers and strings with escapes
+// need a json value built. If raw is set, strings are written without quotes or escaping.
+static void string_agg_value(string_view v, bool raw, utf8_writer& ret) {
+	arena_scope scope;
+
+	auto dump = [&](const json& j) {
+		json_serializer ser(allocate_shared<writer_adapter>(arena_allocator<writer_adapter>{}, ret), ' ');
+
+		ser.dump(j, false, false, 0);
+	};
+
+	switch (v.front()) {
+		case '"': {
+			auto inner = v.substr(1, v.length() - 2);
+
+			if (inner.find('\\') == string::npos) {
+				ret += raw ? inner : v;
+				return;
+			}
+
+			auto dec = json_enc_string_view{inner}.decode();
+
+			if (raw)
+				ret += dec;
+			else
+				dump(json(move(dec)));
+
+			return;
+		}
+
+		case 't':
+		case 'f':
+		case 'n':
+			ret += v;
+			return;
+
+		case '{':
+		case '[':
+			break;
+
+		default:
+			if (is_canonical_integer(v)) {
+				ret += v;
+				return;
+			}
+
+			break;
+	}
+
+	dump(json::parse(v));
+}
+
+template<typename R>
+static void string_agg(R& r, string_view sep, bool raw, utf8_writer& ret) {
+	if (!r.read() || r.node_type() != json_node::array)
+		throw runtime_error("Not an array.");
+
+	bool first = true;
+	string sv, value;
+
+	while (r.read() && r.node_type() != json_node::end_array) {
+		if (!select_member(r, sv, value))
+			continue;
+
+		if (!first)
+			ret += sep;
+
+		string_agg_value(value, raw, ret);
+		first = false;
+	}
+
+	if (r.read())
+		throw runtime_error("Trailing characters after JSON.");
+}
+
+static BSTR string_agg(WCHAR* jsonw, WCHAR* sepw, bool raw) {
+	u16string_view inw = (char16_t*)jsonw;
+	auto sep = utf16_to_utf8((char16_t*)sepw);
+	utf8_writer ret;
+
+	cached(as_bytes(inw), true, [&](auto& r) {
+		ret.reserve(inw.length());
+		string_agg(r, sep, raw, ret);
+	});
+
+	return bstr(ret.str());
+}
+
+static BSTR string_agg_u8(const char* in, UINT len, const char* sep, UINT seplen, bool raw) {
+	string_view sv(in, len);
+	utf8_writer ret;
+
+	cached(sv, false, [&](auto& r) {
+		ret.reserve(len);
+		string_agg(r, string_view(sep, seplen), raw, ret);
+	});
+
+	return bstr_u8(ret.str());
+}
+
+static BSTR string_agg_binary(const char* in, UINT len, string_view sep, bool raw, bool u8) {
+	return from_binary(in, len, u8, [&](jsonb_reader& r, utf8_writer& ret) {
+		ret.reserve(len);
+		string_agg(r, sep, raw, ret);
+	});
 }
 
 extern "C" __declspec(dllexport) BSTR STRING_AGG(WCHAR* jsonw, WCHAR* sepw) noexcept {
-	json j;
+	if (!jsonw || !sepw)
+		return nullptr;
 
+	try {
+		return string_agg(jsonw, sepw, false);
+	} catch (...) {
+		return nullptr;
+	}
+}
+
+extern "C" __declspec(dllexport) BSTR STRING_AGG_U8(const char* in, UINT len, const char* sep, UINT seplen) noexcept {
+	if (!in || !sep)
+		return nullptr;
+
+	try {
+		return string_agg_u8(in, len, sep, seplen, false);
+	} catch (...) {
+		return nullptr;
+	}
+}
+
+// Like STRING_AGG, but strings are written unquoted and unescaped, e.g. for IN lists.
+extern "C" __declspec(dllexport) BSTR STRING_AGG_RAW(WCHAR* jsonw, WCHAR* sepw) noexcept {
 	if (!jsonw || !sepw)
 		return nullptr;
 
-	auto sep = utf16_to_utf8((char16_t*)sepw);
+	try {
+		return string_agg(jsonw, sepw, true);
+	} catch (...) {
+		return nullptr;
+	}
+}
+
+extern "C" __declspec(dllexport) BSTR STRING_AGG_RAW_U8(const char* in, UINT len, const char* sep, UINT seplen) noexcept {
+	if (!in || !sep)
+		return nullptr;
+
+	try {
+		return string_agg_u8(in, len, sep, seplen, true);
+	} catch (...) {
+		return nullptr;
+	}
+}
+
+extern "C" __declspec(dllexport) BSTR STRING_AGG_BINARY(const char* in, UINT len, WCHAR* sepw) noexcept {
+	if (!in || !sepw)
+		return nullptr;
 
 	try {
-		j = json::parse(utf16_to_utf8((char16_t*)jsonw));
+		return string_agg_binary(in, len, utf16_to_utf8((char16_t*)sepw), false, false);
 	} catch (...) {
 		return nullptr;
 	}
+}
+
+extern "C" __declspec(dllexport) BSTR STRING_AGG_BINARY_U8(const char* in, UINT len, const char* sep, UINT seplen) noexcept {
+	if (!in || !sep)
+		return nullptr;
 
-	if (j.type() != json::value_t::array)
+	try {
+		return string_agg_binary(in, len, string_view(sep, seplen), false, true);
+	} catch (...) {
 		return nullptr;
+	}
+}
 
-	u16string ws;
+extern "C" __declspec(dllexport) BSTR STRING_AGG_RAW_BINARY(const char* in, UINT len, WCHAR* sepw) noexcept {
+	if (!in || !sepw)
+		return nullptr;
 
 	try {
-		stringstream ret;
-		bool first = true;
-		string sv;
+		return string_agg_binary(in, len, utf16_to_utf8((char16_t*)sepw), true, false);
+	} catch (...) {
+		return nullptr;
+	}
+}
+
+extern "C" __declspec(dllexport) BSTR STRING_AGG_RAW_BINARY_U8(const char* in, UINT len, const char* sep, UINT seplen) noexcept {
+	if (!in || !sep)
+		return nullptr;
+
+	try {
+		return string_agg_binary(in, len, string_view(sep, seplen), true, true);
+	} catch (...) {
+		return nullptr;
+	}
+}
 
-		for (const auto& el : j) {
-			if (sv.empty()) {
-				if (!el.empty())
-					sv = el.items().begin().key();
+// The batch versions take a buffer of rows, each a 32-bit little-endian length
+// followed by that many bytes of UTF-8, or just a length of 0xffffffff for NULL.
+// The rows are shared out over the thread pool, and the results returned in
+// the same format and order.
+static constexpr uint32_t null_row = 0xffffffff;
+
+static vector<optional<string_view>> split_rows(string_view in) {
+	vector<optional<string_view>> rows;
+
+	while (!in.empty()) {
+		if (in.length() < sizeof(uint32_t))
+			throw runtime_error("Truncated batch.");
+
+		auto len = (uint32_t)(uint8_t)in[0] | ((uint32_t)(uint8_t)in[1] << 8) |
+				   ((uint32_t)(uint8_t)in[2] << 16) | ((uint32_t)(uint8_t)in[3] << 24);
+
+		in.remove_prefix(sizeof(uint32_t));
+
+		if (len == null_row) {
+			rows.emplace_back(nullopt);
+			continue;
+		}
+
+		if (len > in.length())
+			throw runtime_error("Truncated batch.");
+
+		rows.emplace_back(in.substr(0, len));
+		in.remove_prefix(len);
+	}
+
+	return rows;
+}
+
+// Calls f to write the result for each row. A row that's NULL gives
+// null_result, or NULL if that's nullptr, and one that f throws on gives NULL.
+template<typename F>
+static BSTR batch(const char* in, UINT len, const char* null_result, F&& f) {
+	auto rows = split_rows(string_view(in, len));
+	vector<optional<utf8_writer>> results(rows.size());
+	size_t total = 0;
+
+	thread_pool::get().parallel_for(rows.size(), [&](size_t i) {
+		auto& r = results[i];
+
+		try {
+			if (rows[i]) {
+				r.emplace();
+				f(*rows[i], *r);
+			} else if (null_result) {
+				r.emplace();
+				*r += null_result;
 			}
+		} catch (...) {
+			r.reset();
+		}
+	});
+
+	for (const auto& r : results) {
+		total += sizeof(uint32_t) + (r ? r->str().length() : 0);
+	}
+
+	if (total > numeric_limits<UINT>::max())
+		throw runtime_error("Batch result too large.");
+
+	auto b = SysAllocStringByteLen(nullptr, (UINT)total);
+
+	if (!b)
+		return nullptr;
+
+	auto p = (char*)b;
+
+	for (const auto& r : results) {
+		auto l = r ? (uint32_t)r->str().length() : null_row;
+
+		for (unsigned int i = 0; i < sizeof(uint32_t); i++) {
+			*p = (char)(uint8_t)(l >> (i * 8));
+			p++;
+		}
+
+		if (r) {
+			memcpy(p, r->str().data(), r->str().length());
+			p += r->str().length();
+		}
+	}
+
+	return b;
+}
+
+extern "C" __declspec(dllexport) BSTR JSON_PRETTY_BATCH(const char* in, UINT len) noexcept {
+	if (!in)
+		return nullptr;
+
+	try {
+		return batch(in, len, nullptr, [](string_view row, utf8_writer& s) {
+			json_reader r(row);
+
+			s.reserve(row.length());
+			json_pretty(r, s);
+		});
+	} catch (...) {
+		return nullptr;
+	}
+}
+
+extern "C" __declspec(dllexport) BSTR JSON_ARRAY_BATCH(const char* in, UINT len) noexcept {
+	if (!in)
+		return nullptr;
+
+	try {
+		return batch(in, len, "[]", [](string_view row, utf8_writer& s) {
+			json_reader r(row);
+
+			json_array(r, s);
+		});
+	} catch (...) {
+		return nullptr;
+	}
+}
+
+static BSTR string_agg_batch(const char* in, UINT len, string_view sep, bool raw) {
+	return batch(in, len, nullptr, [&](string_view row, utf8_writer& s) {
+		json_reader r(row);
+
+		s.reserve(row.length());
+		string_agg(r, sep, raw, s);
+	});
+}
+
+extern "C" __declspec(dllexport) BSTR STRING_AGG_BATCH(const char* in, UINT len, const char* sep, UINT seplen) noexcept {
+	if (!in || !sep)
+		return nullptr;
+
+	try {
+		return string_agg_batch(in, len, string_view(sep, seplen), false);
+	} catch (...) {
+		return nullptr;
+	}
+}
+
+extern "C" __declspec(dllexport) BSTR STRING_AGG_RAW_BATCH(const char* in, UINT len, const char* sep, UINT seplen) noexcept {
+	if (!in || !sep)
+		return nullptr;
+
+	try {
+		return string_agg_batch(in, len, string_view(sep, seplen), true);
+	} catch (...) {
+		return nullptr;
+	}
+}
+
+// Sets how many threads the batch functions use, including the caller's. 0
+// means one per core, which is the default.
+extern "C" __declspec(dllexport) BOOL JSON_THREADS(UINT n) noexcept {
+	try {
+		thread_pool::get().set_threads(n);
+	} catch (...) {
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+// Stops the batch functions' threads. It has to be called before the DLL's
+// unloaded, as otherwise they keep it loaded. The next batch starts them again.
+extern "C" __declspec(dllexport) BOOL JSON_SHUTDOWN() noexcept {
+	try {
+		thread_pool::get().shutdown();
+	} catch (...) {
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+// The aggregate versions of STRING_AGG, which take the elements one row at a
+// time rather than as one array. A state that has seen a malformed row gives
+// NULL when it's terminated, as STRING_AGG would for the whole array.
+class string_agg_state {
+public:
+	string_agg_state(string_view sep) : sep(sep) { }
+
+	void accumulate(string_view row) {
+		if (failed)
+			return;
+
+		try {
+			json_reader r(row);
+
+			if (!r.read())
+				throw runtime_error("Empty row.");
+
+			if (select_member(r, key, value)) {
+				// an object whose first key is "" leaves the choice still to be made
+				if (key.empty())
+					chose_empty = true;
 
-			if (el.count(sv) != 0) {
 				if (!first)
-					ret << sep;
+					out += sep;
 
-				ret << el.at(sv);
+				string_agg_value(value, false, out);
 				first = false;
 			}
+
+			if (r.read())
+				throw runtime_error("Trailing characters after JSON.");
+		} catch (...) {
+			failed = true;
 		}
+	}
+
+	// Appends the rows of other, which came after ours. The member is chosen by
+	// the first element that has any, so if other picked its values using a
+	// different member from ours, its rows would have had to be read again -
+	// that's treated as an error.
+	void merge(const string_agg_state& other) {
+		if (other.failed)
+			failed = true;
+
+		if (failed)
+			return;
+
+		if (key.empty()) {
+			key = other.key;
+			chose_empty |= other.chose_empty;
+		} else if (other.chose_empty || (!other.key.empty() && other.key != key)) {
+			failed = true;
+			return;
+		}
+
+		if (other.first)
+			return;
+
+		if (!first)
+			out += sep;
+
+		out += other.out.str();
+		first = false;
+	}
 
-		ws = utf8_to_utf16(ret.str());
+	string sep, key, value;
+	utf8_writer out;
+	bool first = true, failed = false, chose_empty = false;
+};
+
+extern "C" __declspec(dllexport) void* STRING_AGG_INIT(WCHAR* sepw) noexcept {
+	if (!sepw)
+		return nullptr;
+
+	try {
+		return new string_agg_state(utf16_to_utf8((char16_t*)sepw));
+	} catch (...) {
+		return nullptr;
+	}
+}
+
+extern "C" __declspec(dllexport) void* STRING_AGG_INIT_U8(const char* sep, UINT seplen) noexcept {
+	if (!sep)
+		return nullptr;
+
+	try {
+		return new string_agg_state(string_view(sep, seplen));
 	} catch (...) {
 		return nullptr;
 	}
+}
+
+extern "C" __declspec(dllexport) BOOL STRING_AGG_ACCUMULATE(void* state, WCHAR* row) noexcept {
+	if (!state)
+		return FALSE;
+
+	auto& st = *(string_agg_state*)state;
+
+	if (!row) // NULLs are ignored, as they are by the built-in aggregates
+		return !st.failed;
+
+	try {
+		st.accumulate(utf16_to_utf8((char16_t*)row));
+	} catch (...) {
+		st.failed = true;
+	}
+
+	return !st.failed;
+}
+
+extern "C" __declspec(dllexport) BOOL STRING_AGG_ACCUMULATE_U8(void* state, const char* row, UINT len) noexcept {
+	if (!state)
+		return FALSE;
+
+	auto& st = *(string_agg_state*)state;
+
+	if (row)
+		st.accumulate(string_view(row, len));
+
+	return !st.failed;
+}
+
+// Appends the rows of other to state, and frees other.
+extern "C" __declspec(dllexport) BOOL STRING_AGG_MERGE(void* state, void* other) noexcept {
+	if (!state || !other)
+		return FALSE;
+
+	auto& st = *(string_agg_state*)state;
+
+	try {
+		st.merge(*(string_agg_state*)other);
+	} catch (...) {
+		st.failed = true;
+	}
+
+	delete (string_agg_state*)other;
+
+	return !st.failed;
+}
+
+// Returns the concatenated values, and frees state.
+extern "C" __declspec(dllexport) BSTR STRING_AGG_TERMINATE(void* state) noexcept {
+	if (!state)
+		return nullptr;
+
+	auto st = (string_agg_state*)state;
+	auto ret = st->failed ? nullptr : bstr(st->out.str());
+
+	delete st;
+
+	return ret;
+}
+
+extern "C" __declspec(dllexport) BSTR STRING_AGG_TERMINATE_U8(void* state) noexcept {
+	if (!state)
+		return nullptr;
+
+	auto st = (string_agg_state*)state;
+	auto ret = st->failed ? nullptr : bstr_u8(st->out.str());
+
+	delete st;
 
-	return bstr(ws);
+	return ret;
 }
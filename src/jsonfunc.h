@@ -2,11 +2,66 @@
 
 #include <windows.h>
 #include <string>
+#include "source.h"
 
-// jsonfunc.cpp
+// utf.cpp
 std::u16string utf8_to_utf16(std::string_view s);
 std::string utf16_to_utf8(std::u16string_view ws);
+bool valid_utf8(std::string_view s);
+BSTR bstr(std::string_view s);
+
+// Transcodes UTF-16 to UTF-8 a chunk at a time, so that a full UTF-8 copy of
+// the input never has to exist.
+class utf16_source : public input_source {
+public:
+	utf16_source(std::u16string_view ws) : ws(ws) { }
+
+	// For a null-terminated string, whose length is only found as it's read, so
+	// that a reader that stops early never has to look at the rest of it.
+	utf16_source(const char16_t* s) : ws(s, 0), find_end(true) { }
+
+	size_t read(char* buf, size_t len) override;
+
+private:
+	std::u16string_view ws;
+	bool find_end = false;
+};
+
+// Collects the UTF-8 output of a serializer, which bstr() then transcodes
+// straight into the returned BSTR, with no intermediate UTF-16 copy.
+class utf8_writer {
+public:
+	constexpr void reserve(size_t len) {
+		s.reserve(len);
+	}
+
+	constexpr utf8_writer& operator+=(std::string_view sv) {
+		s += sv;
+		return *this;
+	}
+
+	constexpr utf8_writer& operator+=(char c) {
+		s += c;
+		return *this;
+	}
+
+	constexpr void append(size_t count, char c) {
+		s.append(count, c);
+	}
+
+	constexpr std::string_view str() const {
+		return s;
+	}
+
+private:
+	std::string s;
+};
 
 static BSTR __inline bstr(std::u16string_view ws) noexcept {
     return SysAllocStringLen((WCHAR*)ws.data(), (UINT)ws.length());
 }
+
+// for the _U8 exports, which return UTF-8 as VARBINARY
+static BSTR __inline bstr_u8(std::string_view s) noexcept {
+    return SysAllocStringByteLen(s.data(), (UINT)s.length());
+}
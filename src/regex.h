@@ -0,0 +1,742 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <stdexcept>
+#include <cstdint>
+#include <utility>
+#include <algorithm>
+
+// A regular expression in the ECMAScript syntax that JSON Schema uses, for
+// pattern and patternProperties. Rather than backtracking, as std::regex does,
+// it follows every way the pattern could match at once, a code point at a time,
+// so the time taken is linear in the length of the string, and nothing recurses
+// while matching - libstdc++'s std::regex recurses for each character, and
+// overflows the stack on long strings. Back references and lookaround aren't
+// supported, as they can't be matched this way.
+class schema_regex {
+public:
+	constexpr schema_regex(std::string_view pattern) {
+		prog = parse_alternation(pattern, 0);
+
+		if (!pattern.empty())
+			throw std::runtime_error("Unmatched ) in regular expression.");
+
+		prog.push_back({op::match});
+	}
+
+	// Whether the pattern matches anywhere within s.
+	constexpr bool search(std::string_view s) const {
+		// Everything is sized up front, as push_back is slow in constant
+		// expressions. Each instruction goes on a list at most once per step,
+		// and on the stack at most twice.
+		thread_list lists[2] = {{std::vector<int32_t>(prog.size())}, {std::vector<int32_t>(prog.size())}};
+		std::vector<int32_t> stack((prog.size() * 2) + 1);
+		std::vector<uint32_t> mark(prog.size(), 0); // the step each instruction was last added at
+		uint32_t step = 1, prev = none;
+		auto [cur, len] = decode(s);
+
+		// a match can start anywhere, unless the pattern begins with ^
+		auto anchored = prog.front().type == op::line_start;
+
+		for (unsigned int i = 0; ; i ^= 1) {
+			auto& clist = lists[i];
+			auto& nlist = lists[i ^ 1];
+
+			if ((prev == none || !anchored) && add(clist, stack, mark, 0, step, prev, cur))
+				return true;
+
+			if (cur == none || (anchored && clist.count == 0))
+				return false;
+
+			s.remove_prefix(len);
+
+			auto [next, next_len] = decode(s);
+
+			step++;
+			nlist.count = 0;
+
+			for (size_t j = 0; j < clist.count; j++) {
+				auto pc = clist.pcs[j];
+
+				if (consumes(prog[(size_t)pc], cur) && add(nlist, stack, mark, pc + 1, step, cur, next))
+					return true;
+			}
+
+			prev = cur;
+			cur = next;
+			len = next_len;
+		}
+	}
+
+private:
+	enum class op : uint8_t {
+		code_point,
+		any,
+		set,
+		split,
+		jump,
+		match,
+		line_start,
+		line_end,
+		word_boundary,
+		not_word_boundary
+	};
+
+	// Jumps are relative, so that a piece of the program can be copied for
+	// a{2,5} and the like.
+	struct inst {
+		op type;
+		int32_t x = 0; // the code point, the set, or where to jump to
+		int32_t y = 0; // the other way a split can go
+	};
+
+	using range = std::pair<uint32_t, uint32_t>;
+
+	struct thread_list {
+		std::vector<int32_t> pcs;
+		size_t count = 0;
+	};
+
+	struct char_set {
+		std::vector<range> ranges; // sorted, and not overlapping
+		bool negated = false;
+	};
+
+	static constexpr uint32_t none = 0xffffffff; // before the start or after the end
+	static constexpr uint32_t infinite = 0xffffffff;
+	static constexpr size_t max_size = 100000;
+	static constexpr unsigned int max_nesting = 100;
+
+	// Invalid UTF-8 comes out as U+FFFD, one byte at a time.
+	static constexpr std::pair<uint32_t, size_t> decode(std::string_view s) {
+		if (s.empty())
+			return {none, 0};
+
+		auto c = (uint8_t)s[0];
+
+		if (c < 0x80)
+			return {c, 1};
+
+		size_t len = c >= 0xf8 ? 0 : c >= 0xf0 ? 4 : c >= 0xe0 ? 3 : c >= 0xc0 ? 2 : 0;
+
+		if (len == 0 || s.length() < len)
+			return {0xfffd, 1};
+
+		uint32_t cp = c & (0x7f >> len);
+
+		for (size_t i = 1; i < len; i++) {
+			if (((uint8_t)s[i] & 0xc0) != 0x80)
+				return {0xfffd, 1};
+
+			cp = (cp << 6) | ((uint8_t)s[i] & 0x3f);
+		}
+
+		return {cp, len};
+	}
+
+	static constexpr uint32_t take(std::string_view& p) {
+		auto [cp, len] = decode(p);
+
+		p.remove_prefix(len);
+
+		return cp;
+	}
+
+	static constexpr bool is_word(uint32_t c) {
+		return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_';
+	}
+
+	static constexpr bool is_line_terminator(uint32_t c) {
+		return c == '\n' || c == '\r' || c == 0x2028 || c == 0x2029;
+	}
+
+	static constexpr bool contains(const char_set& set, uint32_t c) {
+		auto it = std::upper_bound(set.ranges.begin(), set.ranges.end(), c, [](uint32_t c, const range& r) {
+			return c < r.first;
+		});
+
+		auto found = it != set.ranges.begin() && c <= (it - 1)->second;
+
+		return found != set.negated;
+	}
+
+	constexpr bool consumes(const inst& in, uint32_t c) const {
+		switch (in.type) {
+			case op::code_point:
+				return c == (uint32_t)in.x;
+
+			case op::any:
+				return !is_line_terminator(c);
+
+			default:
+				return contains(sets[(size_t)in.x], c);
+		}
+	}
+
+	// Adds the instructions that consume a code point reachable from pc to
+	// list, or returns true if the match is. Those already added at this
+	// step are skipped, which is what stops e.g. (a*)* from looping.
+	constexpr bool add(thread_list& list, std::vector<int32_t>& stack, std::vector<uint32_t>& mark,
+					   int32_t pc, uint32_t step, uint32_t prev, uint32_t next) const {
+		size_t depth = 0;
+
+		stack[depth++] = pc;
+
+		while (depth > 0) {
+			pc = stack[--depth];
+
+			if (mark[(size_t)pc] == step)
+				continue;
+
+			mark[(size_t)pc] = step;
+
+			const auto& in = prog[(size_t)pc];
+
+			switch (in.type) {
+				case op::match:
+					return true;
+
+				case op::jump:
+					stack[depth++] = pc + in.x;
+					break;
+
+				case op::split:
+					stack[depth++] = pc + in.y;
+					stack[depth++] = pc + in.x;
+					break;
+
+				case op::line_start:
+					if (prev == none)
+						stack[depth++] = pc + 1;
+					break;
+
+				case op::line_end:
+					if (next == none)
+						stack[depth++] = pc + 1;
+					break;
+
+				case op::word_boundary:
+				case op::not_word_boundary:
+					if ((is_word(prev) != is_word(next)) == (in.type == op::word_boundary))
+						stack[depth++] = pc + 1;
+					break;
+
+				default:
+					list.pcs[list.count++] = pc;
+					break;
+			}
+		}
+
+		return false;
+	}
+
+	static constexpr void append(std::vector<inst>& code, const std::vector<inst>& more) {
+		if (code.size() + more.size() > max_size)
+			throw std::runtime_error("Regular expression is too large.");
+
+		code.insert(code.end(), more.begin(), more.end());
+	}
+
+	constexpr std::vector<inst> parse_alternation(std::string_view& p, unsigned int depth) {
+		auto code = parse_sequence(p, depth);
+
+		while (!p.empty() && p.front() == '|') {
+			p.remove_prefix(1);
+
+			auto alt = parse_sequence(p, depth);
+			std::vector<inst> c;
+
+			c.push_back({op::split, 1, (int32_t)code.size() + 2});
+			append(c, code);
+			c.push_back({op::jump, (int32_t)alt.size() + 1});
+			append(c, alt);
+			code = std::move(c);
+		}
+
+		return code;
+	}
+
+	constexpr std::vector<inst> parse_sequence(std::string_view& p, unsigned int depth) {
+		std::vector<inst> code;
+
+		while (!p.empty() && p.front() != '|' && p.front() != ')') {
+			append(code, parse_quantified(p, depth));
+		}
+
+		return code;
+	}
+
+	static constexpr bool is_digit(char c) {
+		return c >= '0' && c <= '9';
+	}
+
+	// {n}, {n,} or {n,m} - anything else is taken as a literal {
+	static constexpr bool parse_braces(std::string_view& p, uint32_t& min, uint32_t& max) {
+		auto q = p.substr(1);
+
+		auto number = [&](uint32_t& v) {
+			if (q.empty() || !is_digit(q.front()))
+				return false;
+
+			v = 0;
+
+			while (!q.empty() && is_digit(q.front())) {
+				v = std::min((v * 10) + (uint32_t)(q.front() - '0'), (uint32_t)max_size);
+				q.remove_prefix(1);
+			}
+
+			return true;
+		};
+
+		if (!number(min))
+			return false;
+
+		max = min;
+
+		if (!q.empty() && q.front() == ',') {
+			q.remove_prefix(1);
+
+			if (!number(max))
+				max = infinite;
+		}
+
+		if (q.empty() || q.front() != '}')
+			return false;
+
+		p = q.substr(1);
+
+		return true;
+	}
+
+	constexpr std::vector<inst> parse_quantified(std::string_view& p, unsigned int depth) {
+		auto atom = parse_atom(p, depth);
+		uint32_t min, max;
+
+		if (p.empty())
+			return atom;
+
+		switch (p.front()) {
+			case '*':
+				min = 0;
+				max = infinite;
+				p.remove_prefix(1);
+				break;
+
+			case '+':
+				min = 1;
+				max = infinite;
+				p.remove_prefix(1);
+				break;
+
+			case '?':
+				min = 0;
+				max = 1;
+				p.remove_prefix(1);
+				break;
+
+			case '{':
+				if (parse_braces(p, min, max))
+					break;
+
+				return atom;
+
+			default:
+				return atom;
+		}
+
+		if (min > max)
+			throw std::runtime_error("Numbers out of order in {} quantifier.");
+
+		// lazy or greedy makes no difference to whether there's a match
+		if (!p.empty() && p.front() == '?')
+			p.remove_prefix(1);
+
+		if (!p.empty() && (p.front() == '*' || p.front() == '+' || p.front() == '?'))
+			throw std::runtime_error("Nothing to repeat in regular expression.");
+
+		auto len = (int32_t)atom.size();
+		std::vector<inst> code;
+
+		for (uint32_t i = max == infinite && min > 0 ? 1 : 0; i < min; i++) {
+			append(code, atom);
+		}
+
+		if (max == infinite) {
+			if (min > 0) { // the last copy loops
+				append(code, atom);
+				code.push_back({op::split, -len, 1});
+			} else {
+				code.push_back({op::split, 1, len + 2});
+				append(code, atom);
+				code.push_back({op::jump, -(len + 1)});
+			}
+		} else {
+			for (auto i = min; i < max; i++) {
+				code.push_back({op::split, 1, len + 1});
+				append(code, atom);
+			}
+		}
+
+		return code;
+	}
+
+	constexpr std::vector<inst> parse_atom(std::string_view& p, unsigned int depth) {
+		std::vector<inst> code;
+
+		switch (p.front()) {
+			case '(': {
+				if (depth == max_nesting)
+					throw std::runtime_error("Regular expression is nested too deeply.");
+
+				p.remove_prefix(1);
+
+				if (p.starts_with("?:"))
+					p.remove_prefix(2);
+				else if (p.starts_with("?=") || p.starts_with("?!") || p.starts_with("?<=") || p.starts_with("?<!"))
+					throw std::runtime_error("Lookaround isn't supported in regular expressions.");
+				else if (p.starts_with("?<")) { // named group
+					auto end = p.find('>');
+
+					if (end == std::string_view::npos)
+						throw std::runtime_error("Unterminated group name in regular expression.");
+
+					p.remove_prefix(end + 1);
+				} else if (p.starts_with("?"))
+					throw std::runtime_error("Invalid group in regular expression.");
+
+				code = parse_alternation(p, depth + 1);
+
+				if (p.empty())
+					throw std::runtime_error("Unmatched ( in regular expression.");
+
+				p.remove_prefix(1);
+
+				return code;
+			}
+
+			case '*':
+			case '+':
+			case '?':
+				throw std::runtime_error("Nothing to repeat in regular expression.");
+
+			case '{': {
+				auto q = p;
+				uint32_t min, max;
+
+				if (parse_braces(q, min, max))
+					throw std::runtime_error("Nothing to repeat in regular expression.");
+
+				break;
+			}
+
+			case '[':
+				p.remove_prefix(1);
+				code.push_back({op::set, (int32_t)sets.size()});
+				sets.push_back(parse_class(p));
+				return code;
+
+			case '.':
+				p.remove_prefix(1);
+				code.push_back({op::any});
+				return code;
+
+			case '^':
+				p.remove_prefix(1);
+				code.push_back({op::line_start});
+				return code;
+
+			case '$':
+				p.remove_prefix(1);
+				code.push_back({op::line_end});
+				return code;
+
+			case '\\':
+				p.remove_prefix(1);
+
+				if (p.starts_with("b") || p.starts_with("B")) {
+					code.push_back({p.front() == 'b' ? op::word_boundary : op::not_word_boundary});
+					p.remove_prefix(1);
+					return code;
+				}
+
+				if (!p.empty() && p.front() >= '1' && p.front() <= '9')
+					throw std::runtime_error("Back references aren't supported in regular expressions.");
+
+				if (p.starts_with("k<"))
+					throw std::runtime_error("Back references aren't supported in regular expressions.");
+
+				if (char_set set; class_escape(p, set)) {
+					code.push_back({op::set, (int32_t)sets.size()});
+					sets.push_back(std::move(set));
+					return code;
+				}
+
+				code.push_back({op::code_point, (int32_t)char_escape(p)});
+				return code;
+		}
+
+		code.push_back({op::code_point, (int32_t)take(p)});
+
+		return code;
+	}
+
+	static constexpr void add_ranges(std::vector<range>& ranges, std::initializer_list<range> more, bool negated) {
+		if (!negated) {
+			ranges.insert(ranges.end(), more.begin(), more.end());
+			return;
+		}
+
+		uint32_t start = 0;
+
+		for (auto r : more) {
+			if (r.first > start)
+				ranges.emplace_back(start, r.first - 1);
+
+			start = r.second + 1;
+		}
+
+		ranges.emplace_back(start, 0x10ffff);
+	}
+
+	// \d, \w, \s and their opposites, with p just past the backslash
+	static constexpr bool class_escape(std::string_view& p, char_set& set) {
+		if (p.empty())
+			return false;
+
+		auto c = p.front();
+		auto negated = c >= 'A' && c <= 'Z';
+
+		switch (c) {
+			case 'd':
+			case 'D':
+				add_ranges(set.ranges, {{'0', '9'}}, negated);
+				break;
+
+			case 'w':
+			case 'W':
+				add_ranges(set.ranges, {{'0', '9'}, {'A', 'Z'}, {'_', '_'}, {'a', 'z'}}, negated);
+				break;
+
+			case 's':
+			case 'S':
+				add_ranges(set.ranges, {{'\t', '\r'}, {' ', ' '}, {0xa0, 0xa0}, {0x1680, 0x1680}, {0x2000, 0x200a},
+										{0x2028, 0x2029}, {0x202f, 0x202f}, {0x205f, 0x205f}, {0x3000, 0x3000},
+										{0xfeff, 0xfeff}}, negated);
+				break;
+
+			default:
+				return false;
+		}
+
+		p.remove_prefix(1);
+
+		return true;
+	}
+
+	static constexpr int hex_digit(char c) {
+		if (is_digit(c))
+			return c - '0';
+		else if (c >= 'a' && c <= 'f')
+			return c - 'a' + 10;
+		else if (c >= 'A' && c <= 'F')
+			return c - 'A' + 10;
+		else
+			return -1;
+	}
+
+	// Returns none if p doesn't start with len hex digits.
+	static constexpr uint32_t hex(std::string_view& p, size_t len) {
+		uint32_t v = 0;
+
+		if (p.length() < len)
+			return none;
+
+		for (size_t i = 0; i < len; i++) {
+			auto d = hex_digit(p[i]);
+
+			if (d < 0)
+				return none;
+
+			v = (v << 4) | (uint32_t)d;
+		}
+
+		p.remove_prefix(len);
+
+		return v;
+	}
+
+	// An escape that stands for one code point, with p just past the backslash.
+	static constexpr uint32_t char_escape(std::string_view& p) {
+		if (p.empty())
+			throw std::runtime_error("\\ at end of regular expression.");
+
+		auto c = p.front();
+
+		p.remove_prefix(1);
+
+		switch (c) {
+			case '0':
+				return 0;
+
+			case 'n':
+				return '\n';
+
+			case 'r':
+				return '\r';
+
+			case 't':
+				return '\t';
+
+			case 'f':
+				return '\f';
+
+			case 'v':
+				return '\v';
+
+			case 'c':
+				if (!p.empty() && ((p.front() >= 'a' && p.front() <= 'z') || (p.front() >= 'A' && p.front() <= 'Z')))
+					return (uint32_t)take(p) & 0x1f;
+
+				throw std::runtime_error("Invalid \\c escape in regular expression.");
+
+			case 'x':
+				if (auto v = hex(p, 2); v != none)
+					return v;
+
+				return 'x';
+
+			case 'u': {
+				if (p.starts_with("{")) {
+					auto end = p.find('}');
+					uint32_t v = 0;
+
+					if (end == std::string_view::npos || end == 1 || end > 7)
+						throw std::runtime_error("Invalid \\u escape in regular expression.");
+
+					for (auto d : p.substr(1, end - 1)) {
+						if (hex_digit(d) < 0)
+							throw std::runtime_error("Invalid \\u escape in regular expression.");
+
+						v = (v << 4) | (uint32_t)hex_digit(d);
+					}
+
+					if (v > 0x10ffff)
+						throw std::runtime_error("Invalid \\u escape in regular expression.");
+
+					p.remove_prefix(end + 1);
+
+					return v;
+				}
+
+				auto v = hex(p, 4);
+
+				if (v == none)
+					return 'u';
+
+				// a surrogate pair stands for one code point
+				if (v >= 0xd800 && v <= 0xdbff && p.starts_with("\\u")) {
+					auto q = p.substr(2);
+
+					if (auto lo = hex(q, 4); lo >= 0xdc00 && lo <= 0xdfff && lo != none) {
+						p = q;
+						return 0x10000 + ((v - 0xd800) << 10) + (lo - 0xdc00);
+					}
+				}
+
+				return v;
+			}
+
+			default:
+				// e.g. \. or \/, which stand for themselves
+				p = std::string_view(p.data() - 1, p.length() + 1);
+
+				return take(p);
+		}
+	}
+
+	static constexpr char_set parse_class(std::string_view& p) {
+		char_set set;
+
+		if (p.starts_with("^")) {
+			set.negated = true;
+			p.remove_prefix(1);
+		}
+
+		// Returns none for \d and the like, which are added to set straight away.
+		auto atom = [&]() -> uint32_t {
+			if (!p.starts_with("\\"))
+				return take(p);
+
+			p.remove_prefix(1);
+
+			if (class_escape(p, set))
+				return none;
+
+			if (p.starts_with("b")) { // backspace, within a class
+				p.remove_prefix(1);
+				return '\b';
+			}
+
+			if (p.starts_with("-")) {
+				p.remove_prefix(1);
+				return '-';
+			}
+
+			if (!p.empty() && p.front() >= '1' && p.front() <= '9')
+				throw std::runtime_error("Invalid escape in character class.");
+
+			return char_escape(p);
+		};
+
+		while (true) {
+			if (p.empty())
+				throw std::runtime_error("Unterminated [ in regular expression.");
+
+			if (p.front() == ']') {
+				p.remove_prefix(1);
+				break;
+			}
+
+			auto lo = atom();
+
+			if (lo == none)
+				continue;
+
+			if (p.length() >= 2 && p[0] == '-' && p[1] != ']') {
+				p.remove_prefix(1);
+
+				auto hi = atom();
+
+				if (hi == none)
+					throw std::runtime_error("Invalid range in character class.");
+
+				if (hi < lo)
+					throw std::runtime_error("Range out of order in character class.");
+
+				set.ranges.emplace_back(lo, hi);
+			} else
+				set.ranges.emplace_back(lo, lo);
+		}
+
+		std::sort(set.ranges.begin(), set.ranges.end());
+
+		// merge those that overlap or touch
+		std::vector<range> merged;
+
+		for (auto r : set.ranges) {
+			if (!merged.empty() && r.first <= merged.back().second + 1)
+				merged.back().second = std::max(merged.back().second, r.second);
+			else
+				merged.push_back(r);
+		}
+
+		set.ranges = std::move(merged);
+
+		return set;
+	}
+
+	std::vector<inst> prog;
+	std::vector<char_set> sets;
+};
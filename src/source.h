@@ -0,0 +1,84 @@
+#pragma once
+
+#include <string>
+#include <iterator>
+
+class input_source {
+public:
+	static constexpr size_t chunk_size = 65536;
+
+	// Fills buf with up to len bytes, returning 0 once the input is exhausted.
+	virtual size_t read(char* buf, size_t len) = 0;
+};
+
+// Buffers an input_source a chunk at a time, and exposes it as a pair of input
+// iterators so it can be handed to nlohmann::json::parse.
+class source_buffer {
+public:
+	class iterator {
+	public:
+		using iterator_category = std::input_iterator_tag;
+		using value_type = char;
+		using difference_type = std::ptrdiff_t;
+		using pointer = const char*;
+		using reference = const char&;
+
+		iterator(source_buffer* sb = nullptr) : sb(sb) { }
+
+		reference operator*() const {
+			return sb->buf[sb->pos];
+		}
+
+		iterator& operator++() {
+			sb->pos++;
+
+			if (sb->pos == sb->buf.length())
+				sb->fill();
+
+			return *this;
+		}
+
+		iterator operator++(int) {
+			auto it = *this;
+
+			++*this;
+
+			return it;
+		}
+
+		bool operator==(const iterator& it) const {
+			return at_end() == it.at_end();
+		}
+
+	private:
+		bool at_end() const {
+			return !sb || sb->pos == sb->buf.length();
+		}
+
+		source_buffer* sb;
+	};
+
+	source_buffer(input_source& src) : src(src) {
+		fill();
+	}
+
+	iterator begin() {
+		return iterator{this};
+	}
+
+	iterator end() {
+		return iterator{};
+	}
+
+private:
+	void fill() {
+		buf.resize_and_overwrite(input_source::chunk_size, [&](char* p, size_t n) {
+			return src.read(p, n);
+		});
+		pos = 0;
+	}
+
+	input_source& src;
+	std::string buf;
+	size_t pos;
+};
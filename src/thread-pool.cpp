@@ -0,0 +1,227 @@
+#include "thread-pool.h"
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+
+using namespace std;
+
+thread_pool& thread_pool::get() {
+	// never freed, as there may be no workers to join by the time static
+	// destructors run - at process exit they've already been killed
+	static auto p = new thread_pool;
+
+	return *p;
+}
+
+void thread_pool::start(unsigned int n) {
+	if (n == 0)
+		n = max(thread::hardware_concurrency(), 1u);
+
+	stopping = false;
+
+	for (unsigned int i = 1; i < n; i++) {
+		queues.emplace_back(make_unique<queue>());
+	}
+
+	try {
+		for (size_t i = 0; i < queues.size(); i++) {
+			HMODULE mod;
+
+			// Taken here rather than by the worker, so that there's no moment when
+			// it's running without one. Joining it while the DLL's being unloaded
+			// would deadlock on the loader lock, so this stops that from happening.
+			if (!GetModuleHandleExW(GET_MODULE_HANDLE_EX_FLAG_FROM_ADDRESS, (LPCWSTR)&thread_pool::get, &mod))
+				throw runtime_error("GetModuleHandleExW failed (error " + to_string(GetLastError()) + ").");
+
+			try {
+				workers.emplace_back([this, i, mod]() {
+					worker(i, mod);
+				});
+			} catch (...) {
+				FreeLibrary(mod);
+				throw;
+			}
+		}
+	} catch (...) {
+		stop();
+		throw;
+	}
+
+	started = true;
+}
+
+void thread_pool::stop() {
+	{
+		lock_guard lock(wake_mut);
+		stopping = true;
+	}
+
+	wake.notify_all();
+
+	for (auto& t : workers) {
+		t.join();
+	}
+
+	workers.clear();
+	queues.clear();
+}
+
+void thread_pool::set_threads(unsigned int n) {
+	unique_lock lock(resize_mut);
+
+	stop();
+	requested = n;
+	start(n);
+}
+
+void thread_pool::shutdown() {
+	unique_lock lock(resize_mut);
+
+	stop();
+	started = false;
+}
+
+// A worker's own queue is used last in, first out, and others' first in, first out.
+bool thread_pool::pop(size_t num, task& t) {
+	for (size_t i = 0; i < queues.size(); i++) {
+		auto& q = *queues[(num + i) % queues.size()];
+		lock_guard lock(q.mut);
+
+		if (q.tasks.empty())
+			continue;
+
+		if (i == 0) {
+			t = q.tasks.back();
+			q.tasks.pop_back();
+		} else {
+			t = q.tasks.front();
+			q.tasks.pop_front();
+		}
+
+		pending--;
+
+		return true;
+	}
+
+	return false;
+}
+
+void thread_pool::run(const task& t) {
+	exception_ptr e;
+
+	// once something's failed, the rest won't be looked at
+	if (!t.j->failed) {
+		try {
+			for (auto i = t.begin; i < t.end; i++) {
+				t.j->f(i);
+			}
+		} catch (...) {
+			e = current_exception();
+			t.j->failed = true;
+		}
+	}
+
+	// the caller can't return until this lock's been released
+	lock_guard lock(t.j->mut);
+
+	if (e && !t.j->error)
+		t.j->error = e;
+
+	t.j->remaining -= t.end - t.begin;
+
+	if (t.j->remaining == 0)
+		t.j->cv.notify_all();
+}
+
+void thread_pool::worker(size_t num, HMODULE mod) {
+	while (true) {
+		task t;
+
+		if (pop(num, t)) {
+			run(t);
+			continue;
+		}
+
+		unique_lock lock(wake_mut);
+
+		wake.wait(lock, [&]() {
+			return stopping || pending != 0;
+		});
+
+		if (stopping)
+			break;
+	}
+
+	// The last reference may be this one, if the DLL's already been freed, so
+	// the code that releases it mustn't be ours.
+	FreeLibraryAndExitThread(mod, 0);
+}
+
+void thread_pool::ensure_started() {
+	if (!started) {
+		unique_lock lock(resize_mut);
+
+		if (!started)
+			start(requested);
+	}
+}
+
+unsigned int thread_pool::threads() {
+	ensure_started();
+
+	shared_lock lock(resize_mut);
+
+	return (unsigned int)queues.size() + 1;
+}
+
+void thread_pool::parallel_for(size_t n, const function<void(size_t)>& f) {
+	ensure_started();
+
+	shared_lock lock(resize_mut);
+
+	if (queues.empty() || n < 2) {
+		for (size_t i = 0; i < n; i++) {
+			f(i);
+		}
+
+		return;
+	}
+
+	// a few tasks per thread, so that there's something to steal
+	job j{f, n, {}, {}, {}, false};
+	auto grain = max(n / ((queues.size() + 1) * 4), (size_t)1);
+	size_t num = 0;
+
+	for (size_t i = 0; i < n; i += grain) {
+		auto& q = *queues[num % queues.size()];
+
+		{
+			lock_guard lock2(q.mut);
+			q.tasks.push_back({&j, i, min(i + grain, n)});
+			pending++;
+		}
+
+		num++;
+	}
+
+	{
+		lock_guard lock2(wake_mut);
+	}
+
+	wake.notify_all();
+
+	task t;
+
+	while (pop(num % queues.size(), t)) {
+		run(t);
+	}
+
+	unique_lock lock2(j.mut);
+
+	j.cv.wait(lock2, [&]() {
+		return j.remaining == 0;
+	});
+
+	if (j.error)
+		rethrow_exception(j.error);
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <windows.h>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <condition_variable>
+#include <atomic>
+#include <exception>
+#include <deque>
+#include <thread>
+#include <vector>
+
+// Workers that stay up between calls, for the batch exports. Each has its own
+// queue of tasks, and steals from the others when it runs out - as does the
+// thread that's waiting for them, rather than sitting idle. Each worker holds
+// a reference to the DLL, so that it can't be unloaded from under them:
+// shutdown() has to be called first.
+class thread_pool {
+public:
+	static thread_pool& get();
+
+	// The number of threads work is shared over, including the caller's. 0
+	// means one per core.
+	void set_threads(unsigned int n);
+
+	// The number of threads work is shared over, including the caller's.
+	unsigned int threads();
+
+	// Stops the workers, and waits for them to exit. They're started again by
+	// the next parallel_for, with the same count.
+	void shutdown();
+
+	// Calls f(i) for every i below n, and returns once they've all been done.
+	// If f throws, the calls not yet made may be skipped, and the first
+	// exception is rethrown on the calling thread once the others are done.
+	void parallel_for(size_t n, const std::function<void(size_t)>& f);
+
+private:
+	struct job {
+		const std::function<void(size_t)>& f;
+		size_t remaining;
+		std::mutex mut;
+		std::condition_variable cv;
+		std::exception_ptr error; // under mut
+		std::atomic<bool> failed = false;
+	};
+
+	struct task {
+		job* j;
+		size_t begin;
+		size_t end;
+	};
+
+	struct queue {
+		std::mutex mut;
+		std::deque<task> tasks;
+	};
+
+	void ensure_started();
+	void start(unsigned int n);
+	void stop();
+	void worker(size_t num, HMODULE mod);
+	bool pop(size_t num, task& t);
+	static void run(const task& t);
+
+	std::shared_mutex resize_mut; // held by parallel_for, so that set_threads waits for it
+	std::vector<std::unique_ptr<queue>> queues; // one per worker
+	std::vector<std::thread> workers;
+	std::mutex wake_mut;
+	std::condition_variable wake;
+	std::atomic<size_t> pending = 0; // tasks in the queues
+	bool stopping = false;
+	std::atomic<bool> started = false;
+	unsigned int requested = 0; // as passed to set_threads, under resize_mut
+};
@@ -0,0 +1,347 @@
+#include "jsonfunc.h"
+#include <type_traits>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define USE_SSE2
+#endif
+
+using namespace std;
+
+// Copies the leading run of ASCII characters, eight code units at a time.
+// Returns the number of code units consumed, which is also the number of bytes written.
+static size_t utf16_to_utf8_ascii(const char16_t* in, size_t len, char* out) noexcept {
+	size_t i = 0;
+
+#ifdef USE_SSE2
+	auto mask = _mm_set1_epi16((short)0xff80);
+
+	while (i + 8 <= len) {
+		auto v = _mm_loadu_si128((const __m128i*)(in + i));
+
+		if (_mm_movemask_epi8(_mm_cmpeq_epi16(_mm_and_si128(v, mask), _mm_setzero_si128())) != 0xffff)
+			break;
+
+		_mm_storel_epi64((__m128i*)(out + i), _mm_packus_epi16(v, v));
+		i += 8;
+	}
+#endif
+
+	while (i < len && in[i] < 0x80) {
+		out[i] = (char)in[i];
+		i++;
+	}
+
+	return i;
+}
+
+static size_t utf8_to_utf16_ascii(const char* in, size_t len, char16_t* out) noexcept {
+	size_t i = 0;
+
+#ifdef USE_SSE2
+	while (i + 16 <= len) {
+		auto v = _mm_loadu_si128((const __m128i*)(in + i));
+
+		if (_mm_movemask_epi8(v) != 0)
+			break;
+
+		_mm_storeu_si128((__m128i*)(out + i), _mm_unpacklo_epi8(v, _mm_setzero_si128()));
+		_mm_storeu_si128((__m128i*)(out + i + 8), _mm_unpackhi_epi8(v, _mm_setzero_si128()));
+		i += 16;
+	}
+#endif
+
+	while (i < len && !((uint8_t)in[i] & 0x80)) {
+		out[i] = (char16_t)in[i];
+		i++;
+	}
+
+	return i;
+}
+
+// out needs room for 3 * ws.length() bytes. Unpaired surrogates become U+FFFD,
+// as they do with WideCharToMultiByte.
+static constexpr size_t transcode(u16string_view ws, char* out) {
+	size_t i = 0, o = 0;
+
+	while (i < ws.length()) {
+		if (!is_constant_evaluated() && ws[i] < 0x80) {
+			auto ascii = utf16_to_utf8_ascii(ws.data() + i, ws.length() - i, out + o);
+
+			i += ascii;
+			o += ascii;
+
+			if (i == ws.length())
+				break;
+		}
+
+		auto c = (uint32_t)ws[i];
+
+		i++;
+
+		if (c < 0x80)
+			out[o++] = (char)c;
+		else if (c < 0x800) {
+			out[o++] = (char)(0xc0 | (c >> 6));
+			out[o++] = (char)(0x80 | (c & 0x3f));
+		} else if (c >= 0xd800 && c <= 0xdbff && i < ws.length() && ws[i] >= 0xdc00 && ws[i] <= 0xdfff) {
+			c = 0x10000 + ((c - 0xd800) << 10) + (uint32_t)(ws[i] - 0xdc00);
+			i++;
+
+			out[o++] = (char)(0xf0 | (c >> 18));
+			out[o++] = (char)(0x80 | ((c >> 12) & 0x3f));
+			out[o++] = (char)(0x80 | ((c >> 6) & 0x3f));
+			out[o++] = (char)(0x80 | (c & 0x3f));
+		} else {
+			if (c >= 0xd800 && c <= 0xdfff)
+				c = 0xfffd;
+
+			out[o++] = (char)(0xe0 | (c >> 12));
+			out[o++] = (char)(0x80 | ((c >> 6) & 0x3f));
+			out[o++] = (char)(0x80 | (c & 0x3f));
+		}
+	}
+
+	return o;
+}
+
+// Returns the length of the valid UTF-8 sequence at s[i], or 0 if it's invalid.
+static constexpr size_t sequence_length(string_view s, size_t i) {
+	auto cont = [&](size_t pos, uint8_t lo = 0x80, uint8_t hi = 0xbf) {
+		return pos < s.length() && (uint8_t)s[pos] >= lo && (uint8_t)s[pos] <= hi;
+	};
+
+	auto c = (uint8_t)s[i];
+
+	if (c < 0x80)
+		return 1;
+	else if (c >= 0xc2 && c <= 0xdf && cont(i + 1))
+		return 2;
+	else if (c >= 0xe0 && c <= 0xef && cont(i + 1, c == 0xe0 ? 0xa0 : 0x80, c == 0xed ? 0x9f : 0xbf) && cont(i + 2))
+		return 3;
+	else if (c >= 0xf0 && c <= 0xf4 && cont(i + 1, c == 0xf0 ? 0x90 : 0x80, c == 0xf4 ? 0x8f : 0xbf) && cont(i + 2) && cont(i + 3))
+		return 4;
+	else
+		return 0;
+}
+
+static size_t ascii_length(const char* in, size_t len) noexcept {
+	size_t i = 0;
+
+#ifdef USE_SSE2
+	while (i + 16 <= len) {
+		if (_mm_movemask_epi8(_mm_loadu_si128((const __m128i*)(in + i))) != 0)
+			break;
+
+		i += 16;
+	}
+#endif
+
+	while (i < len && !((uint8_t)in[i] & 0x80)) {
+		i++;
+	}
+
+	return i;
+}
+
+// Returns the number of code units transcode() will produce for s.
+static constexpr size_t utf16_length(string_view s) {
+	size_t i = 0, len = 0;
+
+	while (i < s.length()) {
+		if (!is_constant_evaluated() && !((uint8_t)s[i] & 0x80)) {
+			auto ascii = ascii_length(s.data() + i, s.length() - i);
+
+			i += ascii;
+			len += ascii;
+
+			if (i == s.length())
+				break;
+		}
+
+		auto seq = sequence_length(s, i);
+
+		i += seq == 0 ? 1 : seq;
+		len += seq == 4 ? 2 : 1;
+	}
+
+	return len;
+}
+
+// out needs room for s.length() code units. Invalid sequences become U+FFFD,
+// as they do with MultiByteToWideChar.
+static constexpr size_t transcode(string_view s, char16_t* out) {
+	size_t i = 0, o = 0;
+
+	while (i < s.length()) {
+		if (!is_constant_evaluated() && !((uint8_t)s[i] & 0x80)) {
+			auto ascii = utf8_to_utf16_ascii(s.data() + i, s.length() - i, out + o);
+
+			i += ascii;
+			o += ascii;
+
+			if (i == s.length())
+				break;
+		}
+
+		auto c = (uint8_t)s[i];
+
+		switch (sequence_length(s, i)) {
+			case 1:
+				out[o++] = c;
+				i++;
+				break;
+
+			case 2:
+				out[o++] = (char16_t)(((c & 0x1f) << 6) | (s[i + 1] & 0x3f));
+				i += 2;
+				break;
+
+			case 3:
+				out[o++] = (char16_t)(((c & 0xf) << 12) | ((s[i + 1] & 0x3f) << 6) | (s[i + 2] & 0x3f));
+				i += 3;
+				break;
+
+			case 4: {
+				auto cp = (uint32_t)(((c & 0x7) << 18) | ((s[i + 1] & 0x3f) << 12) | ((s[i + 2] & 0x3f) << 6) | (s[i + 3] & 0x3f));
+
+				cp -= 0x10000;
+				out[o++] = (char16_t)(0xd800 | (cp >> 10));
+				out[o++] = (char16_t)(0xdc00 | (cp & 0x3ff));
+				i += 4;
+				break;
+			}
+
+			default:
+				out[o++] = 0xfffd;
+				i++;
+				break;
+		}
+	}
+
+	return o;
+}
+
+static constexpr bool is_valid_utf8(string_view s) {
+	size_t i = 0;
+
+	while (i < s.length()) {
+		if (!is_constant_evaluated() && !((uint8_t)s[i] & 0x80)) {
+			i += ascii_length(s.data() + i, s.length() - i);
+
+			if (i == s.length())
+				break;
+		}
+
+		auto seq = sequence_length(s, i);
+
+		if (seq == 0)
+			return false;
+
+		i += seq;
+	}
+
+	return true;
+}
+
+static constexpr string utf16_to_utf8_str(u16string_view ws) {
+	string s;
+
+	s.resize_and_overwrite(ws.length() * 3, [&](char* out, size_t) {
+		return transcode(ws, out);
+	});
+
+	return s;
+}
+
+static constexpr u16string utf8_to_utf16_str(string_view s) {
+	u16string ws;
+
+	ws.resize_and_overwrite(s.length(), [&](char16_t* out, size_t) {
+		return transcode(s, out);
+	});
+
+	return ws;
+}
+
+static_assert(utf16_to_utf8_str(u"") == "");
+static_assert(utf16_to_utf8_str(u"hello") == "hello");
+static_assert(utf16_to_utf8_str(u"caf\xe9 \xfc\xdf") == "caf\xc3\xa9 \xc3\xbc\xc3\x9f");
+static_assert(utf16_to_utf8_str(u"\x65e5\x672c\x8a9e") == "\xe6\x97\xa5\xe6\x9c\xac\xe8\xaa\x9e");
+static_assert(utf16_to_utf8_str(u"\U0001f600x") == "\xf0\x9f\x98\x80x");
+static_assert(utf16_to_utf8_str(u"a\xd83d" u"b") == "a\xef\xbf\xbd" "b"); // unpaired high surrogate
+static_assert(utf16_to_utf8_str(u"\xde00") == "\xef\xbf\xbd"); // unpaired low surrogate
+static_assert(utf16_to_utf8_str(u"\xd83d") == "\xef\xbf\xbd"); // truncated pair
+
+static_assert(utf8_to_utf16_str("") == u"");
+static_assert(utf8_to_utf16_str("hello") == u"hello");
+static_assert(utf8_to_utf16_str("caf\xc3\xa9 \xc3\xbc\xc3\x9f") == u"caf\xe9 \xfc\xdf");
+static_assert(utf8_to_utf16_str("\xe6\x97\xa5\xe6\x9c\xac\xe8\xaa\x9e") == u"\x65e5\x672c\x8a9e");
+static_assert(utf8_to_utf16_str("\xf0\x9f\x98\x80x") == u"\U0001f600x");
+static_assert(utf8_to_utf16_str("a\xff" "b") == u"a\xfffd" u"b");
+static_assert(utf8_to_utf16_str("\xc0\xaf") == u"\xfffd\xfffd"); // overlong
+static_assert(utf8_to_utf16_str("\xed\xa0\x80") == u"\xfffd\xfffd\xfffd"); // encoded surrogate
+static_assert(utf8_to_utf16_str("\xe6\x97") == u"\xfffd\xfffd"); // truncated
+
+static_assert(utf16_length("") == 0);
+static_assert(utf16_length("caf\xc3\xa9") == 4);
+static_assert(utf16_length("\xf0\x9f\x98\x80x") == 3);
+static_assert(utf16_length("\xc0\xaf\xe6\x97") == 4);
+
+static_assert(is_valid_utf8(""));
+static_assert(is_valid_utf8("caf\xc3\xa9 \xf0\x9f\x98\x80"));
+static_assert(!is_valid_utf8("a\xff"));
+static_assert(!is_valid_utf8("\xc0\xaf")); // overlong
+static_assert(!is_valid_utf8("\xed\xa0\x80")); // encoded surrogate
+static_assert(!is_valid_utf8("\xe6\x97")); // truncated
+
+bool valid_utf8(string_view s) {
+	return is_valid_utf8(s);
+}
+
+string utf16_to_utf8(u16string_view ws) {
+	return utf16_to_utf8_str(ws);
+}
+
+u16string utf8_to_utf16(string_view s) {
+	return utf8_to_utf16_str(s);
+}
+
+BSTR bstr(string_view s) {
+	auto len = utf16_length(s);
+	auto b = SysAllocStringLen(nullptr, (UINT)len);
+
+	if (b)
+		transcode(s, (char16_t*)b);
+
+	return b;
+}
+
+size_t utf16_source::read(char* buf, size_t len) {
+	// find enough of a null-terminated string for this chunk, plus one more
+	// code unit to check for a surrogate pair
+	if (find_end) {
+		auto l = ws.length();
+
+		while (l <= len / 3 && ws.data()[l] != 0) {
+			l++;
+		}
+
+		if (l <= len / 3)
+			find_end = false;
+
+		ws = u16string_view(ws.data(), l);
+	}
+
+	auto n = min(ws.length(), len / 3);
+
+	// don't split a surrogate pair between chunks
+	if (n > 1 && n < ws.length() && ws[n - 1] >= 0xd800 && ws[n - 1] <= 0xdbff)
+		n--;
+
+	auto ret = transcode(ws.substr(0, n), buf);
+
+	ws.remove_prefix(n);
+
+	return ret;
+}
@@ -0,0 +1,435 @@
+#include <windows.h>
+#include "jsonfunc.h"
+#include "xml.h"
+#include <algorithm>
+#include <bit>
+
+using namespace std;
+
+enum class xml_axis {
+	child,
+	descendant
+};
+
+// A step of the XPath subset XML_VALUE takes. An empty prefix or local_name
+// stands for *, and a position of 0 means there's no predicate.
+struct xml_path_step {
+	xml_axis axis;
+	string prefix;
+	string local_name;
+	size_t position = 0;
+};
+
+// Each step is a bit in the matching in xml_value, so there can be no more than
+// 63 of them.
+struct xml_path {
+	vector<xml_path_step> steps;
+	optional<xml_path_step> attribute;
+	uint64_t desc_mask = 0; // steps with the descendant axis
+};
+
+// Parses a path such as /a/b[2]/@c, //ns:d/*, or /e//f/@ns:g. Unprefixed
+// names match elements in any namespace; prefixes are those of the document,
+// as they are in scope at the element being tested, plus xml.
+static constexpr xml_path parse_xml_path(string_view sv) {
+	xml_path path;
+
+	if (sv.empty() || sv.front() != '/')
+		throw runtime_error("XML path must start with /.");
+
+	while (!sv.empty()) {
+		xml_path_step step;
+
+		if (path.attribute)
+			throw runtime_error("Attribute must be the last step of XML path.");
+
+		if (sv.front() != '/')
+			throw runtime_error("Malformed XML path.");
+
+		sv.remove_prefix(1);
+
+		if (!sv.empty() && sv.front() == '/') {
+			step.axis = xml_axis::descendant;
+			sv.remove_prefix(1);
+		} else
+			step.axis = xml_axis::child;
+
+		bool is_attribute = !sv.empty() && sv.front() == '@';
+
+		if (is_attribute)
+			sv.remove_prefix(1);
+
+		auto name = sv.substr(0, sv.find_first_of("/["));
+
+		sv.remove_prefix(name.length());
+
+		if (auto colon = name.find(':'); colon != string_view::npos) {
+			step.prefix = name.substr(0, colon);
+			name = name.substr(colon + 1);
+
+			if (step.prefix.empty())
+				throw runtime_error("Empty prefix in XML path.");
+
+			if (step.prefix == "*")
+				step.prefix.clear();
+		}
+
+		if (name.empty())
+			throw runtime_error("Empty name in XML path.");
+
+		if (name != "*")
+			step.local_name = name;
+
+		if (!sv.empty() && sv.front() == '[') {
+			auto end = sv.find(']');
+
+			if (end == string::npos)
+				throw runtime_error("Unterminated predicate in XML path.");
+
+			auto digits = sv.substr(1, end - 1);
+
+			if (digits.empty() || digits.length() > 18 || digits.find_first_not_of("0123456789") != string_view::npos)
+				throw runtime_error("Invalid position in XML path.");
+
+			for (auto c : digits) {
+				step.position = (step.position * 10) + (size_t)(c - '0');
+			}
+
+			if (step.position == 0)
+				throw runtime_error("Invalid position in XML path.");
+
+			if (is_attribute)
+				throw runtime_error("Attributes can't have a position in XML path.");
+
+			sv.remove_prefix(end + 1);
+		}
+
+		if (is_attribute)
+			path.attribute = move(step);
+		else {
+			if (path.steps.size() == 63)
+				throw runtime_error("Too many steps in XML path.");
+
+			if (step.axis == xml_axis::descendant)
+				path.desc_mask |= 1ull << path.steps.size();
+
+			path.steps.push_back(move(step));
+		}
+	}
+
+	if (path.steps.empty())
+		throw runtime_error("XML path has no elements.");
+
+	return path;
+}
+
+// Compiled paths are kept per thread, most recently used first.
+static const xml_path& compiled_xml_path(string_view sv) {
+	static constexpr size_t cache_size = 16;
+	thread_local vector<pair<string, xml_path>> cache;
+
+	auto it = find_if(cache.begin(), cache.end(), [&](const auto& p) {
+		return p.first == sv;
+	});
+
+	if (it != cache.end())
+		rotate(cache.begin(), it, it + 1);
+	else {
+		auto path = parse_xml_path(sv);
+
+		if (cache.size() == cache_size)
+			cache.pop_back();
+
+		cache.emplace(cache.begin(), string{sv}, move(path));
+	}
+
+	return cache.front().second;
+}
+
+static constexpr bool name_matches(const xml_reader& r, const xml_path_step& step) {
+	if (!step.local_name.empty() && r.local_name() != step.local_name)
+		return false;
+
+	if (step.prefix.empty())
+		return true;
+
+	auto uri = r.namespace_uri_raw(step.prefix);
+
+	return !uri.empty() && r.namespace_uri_raw().raw() == uri.raw();
+}
+
+// Namespace declarations look like attributes, but aren't as far as XPath is
+// concerned.
+static constexpr bool is_namespace_decl(string_view local_name, string_view prefix) {
+	return prefix == "xmlns" || (prefix.empty() && local_name == "xmlns");
+}
+
+// The string value of the element r is on, i.e. all the text within it. This
+// leaves r on its end tag.
+static constexpr string element_text(xml_reader& r) {
+	string s;
+
+	if (r.is_empty())
+		return s;
+
+	for (unsigned int depth = 0; r.read(); ) {
+		switch (r.node_type()) {
+			case xml_node::element:
+				if (!r.is_empty())
+					depth++;
+				break;
+
+			case xml_node::end_element:
+				if (depth == 0)
+					return s;
+
+				depth--;
+				break;
+
+			case xml_node::text:
+			case xml_node::cdata:
+				s += r.value();
+				break;
+
+			case xml_node::whitespace:
+				s += r.raw();
+				break;
+
+			default:
+				break;
+		}
+	}
+
+	return s;
+}
+
+// Returns the value of the first node in document order that path selects,
+// having read no further than it. Each open element has the set of steps
+// that it's the context for: bit k means that it was reached by the first k
+// steps, so that a child of it matching step k is reached by k + 1. The
+// descendant axis works from the union of these over the element and its
+// ancestors. Positions are counted for each parent, as with XPath's
+// //a[2]. Once no open element can lead to a match, the rest of the document
+// isn't read.
+static constexpr optional<string> xml_value(xml_reader& r, const xml_path& path) {
+	auto n = path.steps.size();
+	auto full = 1ull << n;
+	auto desc_mask = path.desc_mask;
+
+	if (path.attribute && path.attribute->axis == xml_axis::descendant)
+		desc_mask |= full;
+
+	struct frame {
+		uint64_t states;
+		uint64_t inherited;
+	};
+
+	vector<frame> stack;
+	vector<size_t> counts; // the positions so far, n for each frame
+
+	// the document is the context of the first step
+	stack.push_back({1, 1});
+	counts.resize(n);
+
+	auto live = [&](size_t i) {
+		const auto& f = stack[i];
+
+		if (f.inherited & desc_mask)
+			return true;
+
+		for (size_t k = 0; k < n; k++) {
+			if (!(f.states & (1ull << k)) || path.steps[k].axis == xml_axis::descendant)
+				continue;
+
+			if (path.steps[k].position == 0 || counts[(i * n) + k] < path.steps[k].position)
+				return true;
+		}
+
+		return false;
+	};
+
+	auto any_live = [&]() {
+		for (auto i = stack.size(); i > 0; i--) {
+			if (live(i - 1))
+				return true;
+		}
+
+		return false;
+	};
+
+	while (r.read()) {
+		if (r.node_type() == xml_node::end_element) {
+			if (stack.size() == 1)
+				throw runtime_error("Unexpected end tag.");
+
+			stack.pop_back();
+			counts.resize(stack.size() * n);
+
+			// once the document element has closed, there's nothing left to match
+			if (stack.size() == 1 || !any_live())
+				return nullopt;
+
+			continue;
+		}
+
+		if (r.node_type() != xml_node::element)
+			continue;
+
+		auto& parent = stack.back();
+		auto parent_counts = counts.data() + ((stack.size() - 1) * n);
+		uint64_t states = 0;
+		auto candidates = ((parent.states & ~path.desc_mask) | (parent.inherited & path.desc_mask)) & (full - 1);
+
+		while (candidates != 0) {
+			auto k = (size_t)countr_zero(candidates);
+			const auto& step = path.steps[k];
+
+			candidates &= candidates - 1;
+
+			if (!name_matches(r, step))
+				continue;
+
+			if (step.position != 0 && ++parent_counts[k] != step.position)
+				continue;
+
+			states |= 1ull << (k + 1);
+		}
+
+		auto inherited = parent.inherited | states;
+
+		if (!path.attribute) {
+			if (states & full)
+				return element_text(r);
+		} else if ((path.attribute->axis == xml_axis::child ? states : inherited) & full) {
+			const auto& att = *path.attribute;
+
+			if (att.local_name.empty()) {
+				optional<string> ret;
+
+				// @* or @ns:*
+				r.attributes_loop_raw([&](string_view local_name, string_view prefix, xml_enc_string_view ns, xml_enc_string_view value) {
+					if (is_namespace_decl(local_name, prefix))
+						return true;
+
+					if (!att.prefix.empty() && (ns.empty() || ns.raw() != r.namespace_uri_raw(att.prefix).raw()))
+						return true;
+
+					ret = value.decode();
+					return false;
+				});
+
+				if (ret)
+					return ret;
+			} else {
+				auto ns = att.prefix.empty() ? xml_enc_string_view{} : r.namespace_uri_raw(att.prefix);
+
+				if ((att.prefix.empty() && att.local_name != "xmlns") || !ns.empty()) {
+					if (auto v = r.get_attribute(att.local_name, ns.raw()))
+						return v->decode();
+				}
+			}
+		}
+
+		auto document_element = stack.size() == 1;
+
+		// the document can't have another child element
+		if (document_element)
+			parent.states = 0;
+
+		if (r.is_empty()) {
+			if (document_element)
+				return nullopt;
+
+			continue;
+		}
+
+		stack.push_back({states, inherited});
+		counts.resize(stack.size() * n);
+
+		if (document_element && !any_live())
+			return nullopt;
+	}
+
+	return nullopt;
+}
+
+static constexpr optional<string> xml_value(string_view xml, string_view path) {
+	xml_reader r(xml);
+
+	return xml_value(r, parse_xml_path(path));
+}
+
+// the child and descendant axes
+static_assert(xml_value("<a><b><c>1</c></b><c>2</c></a>", "/a/c") == "2" && xml_value("<a><b><c>1</c></b><c>2</c></a>", "//c") == "1");
+static_assert(xml_value("<a><b><c>1</c></b><c>2</c></a>", "/a//c") == "1" && xml_value("<a><b><c>1</c></b><c>2</c></a>", "/a/*/c") == "1");
+static_assert(!xml_value("<a><b><c>1</c></b></a>", "/c") && !xml_value("<a><b><c>1</c></b></a>", "/b//c"));
+static_assert(xml_value("<a>x &amp; &#233;<b>y</b><![CDATA[<z>]]></a>", "/a") == "x & \xc3\xa9y<z>");
+
+// positions are counted for each parent
+static_assert(xml_value("<a><b><c>1</c><c>2</c></b><b><c>3</c><c>4</c></b></a>", "//c[2]") == "2");
+static_assert(xml_value("<a><b><c>1</c><c>2</c></b><b><c>3</c><c>4</c></b></a>", "/a/b[2]/c[1]") == "3");
+static_assert(xml_value("<a><b><c>1</c><c>2</c></b><b><c>3</c><c>4</c></b></a>", "//b[2]//c[2]") == "4");
+static_assert(!xml_value("<a><b><c>1</c><c>2</c></b><b><c>3</c><c>4</c></b></a>", "/a/b/c[3]"));
+
+// attributes, where namespace declarations aren't attributes
+static_assert(xml_value("<a xmlns=\"u\" xmlns:p=\"v\" p:x=\"1\" y=\"2\"/>", "/a/@*") == "1");
+static_assert(xml_value("<a xmlns:p=\"v\" y=\"2\" p:x=\"1\"/>", "/a/@p:*") == "1" && xml_value("<a y=\"&lt;\"/>", "/a/@y") == "<");
+static_assert(!xml_value("<a xmlns=\"u\" xmlns:p=\"v\"/>", "/a/@*") && !xml_value("<a xmlns=\"u\"/>", "/a/@xmlns"));
+static_assert(xml_value("<a><b x=\"1\"/><b x=\"2\"/></a>", "/a/b[2]/@x") == "2" && xml_value("<a><b><c x=\"1\"/></b></a>", "/a//@x") == "1");
+
+// Prefixes are bound by the document, as at the element, and xml always is.
+static_assert(xml_value("<a xmlns:p=\"u\"><q:b xmlns:q=\"u\">1</q:b></a>", "/a/p:b") == "1" && !xml_value("<a xmlns:p=\"u\"/>", "/p:a"));
+static_assert(xml_value("<p:a xmlns:p=\"u\"><b xmlns=\"v\">1</b></p:a>", "/*:a/b") == "1" && !xml_value("<a><b>1</b></a>", "/a/p:b"));
+static_assert(xml_value("<a xmlns:p=\"u\"><b xmlns:p=\"v\"><p:c>1</p:c></b><p:c>2</p:c></a>", "//p:c") == "1");
+static_assert(xml_value("<a xml:lang=\"en\" lang=\"fr\"/>", "/a/@xml:lang") == "en" && xml_value("<a xml:lang=\"en\" lang=\"fr\"/>", "/a/@lang") == "fr");
+
+// Nothing after the document element, or after there can be no match, is read
+// - so the unterminated comments here are never reached.
+static_assert(xml_value("<a><b>1</b><!--", "/a/b") == "1" && !xml_value("<a><b/></a><!--", "/a/c") && !xml_value("<a/><!--", "/a/b"));
+static_assert(!xml_value("<a><b/><b><c>1</c></b><!--", "/a/b[1]/c"));
+
+extern "C" __declspec(dllexport) BSTR XML_VALUE(WCHAR* in, WCHAR* pathw) noexcept {
+	if (!in || !pathw)
+		return nullptr;
+
+	try {
+		auto inw = (const char16_t*)in;
+
+		if (*inw == u'\xfeff') // BOM
+			inw++;
+
+		// null-terminated, so that nothing past the match is looked at
+		utf16_source src(inw);
+		xml_reader r(src);
+		auto v = xml_value(r, compiled_xml_path(utf16_to_utf8((char16_t*)pathw)));
+
+		if (!v)
+			return nullptr;
+
+		return bstr(*v);
+	} catch (...) {
+		return nullptr;
+	}
+}
+
+extern "C" __declspec(dllexport) BSTR XML_VALUE_U8(const char* in, UINT len, const char* path, UINT pathlen) noexcept {
+	if (!in || !path)
+		return nullptr;
+
+	try {
+		string_view inu(in, len);
+
+		if (inu.starts_with("\xef\xbb\xbf")) // BOM
+			inu.remove_prefix(3);
+
+		xml_reader r(inu);
+		auto v = xml_value(r, compiled_xml_path(string_view(path, pathlen)));
+
+		if (!v)
+			return nullptr;
+
+		return bstr_u8(*v);
+	} catch (...) {
+		return nullptr;
+	}
+}
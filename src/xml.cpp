@@ -1,12 +1,13 @@
 #include <windows.h>
 #include "jsonfunc.h"
 #include "xml.h"
+#include "compress.h"
+#include "file.h"
 
 using namespace std;
 
-static constexpr string reescape_att(string_view sv) {
-	string s;
-
+template<typename W>
+static constexpr void reescape_att(W& s, string_view sv) {
 	while (!sv.empty()) {
 		auto c = sv.front();
 
@@ -22,8 +23,11 @@ static constexpr string reescape_att(string_view sv) {
 
 			if (ent == "apos")
 				s += "'";
-			else
-				s += "&" + string(ent) + ";";
+			else {
+				s += "&";
+				s += ent;
+				s += ";";
+			}
 
 			// FIXME - decode decimal or hex references?
 
@@ -33,22 +37,16 @@ static constexpr string reescape_att(string_view sv) {
 		else
 			s += c;
 	}
-
-	return s;
 }
 
-static constexpr string xml_pretty2(string_view inu) {
-	string s;
+// W is utf8_writer, file_writer for XML_PRETTY_FILE, or gzip_writer for
+// XML_PRETTY_COMPRESS.
+template<typename W>
+static constexpr void xml_pretty2(xml_reader& r, W& s) {
 	string prefix;
 	bool needs_newline = false;
 	vector<int> has_text;
 
-	if (inu.size() >= 3 && (uint8_t)inu[0] == 0xef && (uint8_t)inu[1] == 0xbb && (uint8_t)inu[2] == 0xbf) // BOM
-		inu = inu.substr(3);
-
-	xml_reader r(inu);
-	s.reserve(inu.length());
-
 	while (r.read()) {
 		switch (r.node_type()) {
 			case xml_node::whitespace:
@@ -77,7 +75,7 @@ static constexpr string xml_pretty2(string_view inu) {
 
 					s += local_name;
 					s += "=\"";
-					s += reescape_att(value_raw.raw());
+					reescape_att(s, value_raw.raw());
 					s += "\"";
 
 					return true;
@@ -150,8 +148,23 @@ static constexpr string xml_pretty2(string_view inu) {
 				break;
 		}
 	}
+}
 
-	return s;
+static constexpr void xml_pretty2(string_view inu, utf8_writer& s) {
+	if (inu.size() >= 3 && (uint8_t)inu[0] == 0xef && (uint8_t)inu[1] == 0xbb && (uint8_t)inu[2] == 0xbf) // BOM
+		inu = inu.substr(3);
+
+	xml_reader r(inu);
+	s.reserve(inu.length());
+	xml_pretty2(r, s);
+}
+
+static constexpr string xml_pretty2(string_view inu) {
+	utf8_writer s;
+
+	xml_pretty2(inu, s);
+
+	return string{s.str()};
 }
 
 static_assert(xml_pretty2("<a><b /><c att=\"value\">text</c><d><e></e></d><f>hel<b>lo wor</b>ld</f><g><h/>text</g></a>") == R"(<a>
@@ -185,19 +198,258 @@ static_assert(xml_pretty2("<a att1='foo' att2=\"bar\"/>") == "<a att1=\"foo\" at
 static_assert(xml_pretty2("<a att1='&apos;\"' att2=\"'&quot;\"/>") == "<a att1=\"'&quot;\" att2=\"'&quot;\" />\n");
 static_assert(xml_pretty2("<a><c><![CDATA[foo]]></c></a>") == "<a>\n    <c><![CDATA[foo]]></c>\n</a>\n");
 
+// The raw nodes of xml, separated by |, with whitespace nodes marked by a _.
+static constexpr string xml_split(string_view xml) {
+	xml_reader r(xml);
+	string ret;
+
+	while (r.read()) {
+		if (!ret.empty())
+			ret += "|";
+
+		if (r.node_type() == xml_node::whitespace)
+			ret += "_";
+
+		ret += r.raw();
+	}
+
+	return ret;
+}
+
+// Moves every delimiter through each offset of a 16-byte block, past the 32 and
+// 64 bytes that are scanned a block at a time, and up to the end of the input.
+static constexpr bool xml_split_boundaries() {
+	for (size_t n = 1; n <= 70; n++) {
+		string text(n, 'x'), ws(n, ' ');
+		auto tag = "<a b=\"" + text + "\">";
+		auto comment = "<!--" + string(n, '-') + "-->";
+		auto cdata = "<![CDATA[" + string(n, ']') + "]]>";
+		auto pi = "<?p " + string(n, '?') + "?>";
+
+		auto xml = text + tag + ws + "y" + ws + comment + ws + cdata + pi + "</a>" + text;
+
+		if (xml_split(xml) != text + "|" + tag + "|" + ws + "y" + ws + "|" + comment + "|_" + ws + "|" + cdata + "|" + pi + "|</a>|" + text)
+			return false;
+	}
+
+	return true;
+}
+
+static_assert(xml_split("<a>" + string(13, 'x') + "</a>") == "<a>|" + string(13, 'x') + "|</a>");
+static_assert(xml_split("<a>" + string(29, ' ') + "</a>") == "<a>|_" + string(29, ' ') + "|</a>");
+static_assert(xml_split(string(15, ' ') + "x") == string(15, ' ') + "x");
+static_assert(xml_split("<a" + string(30, ' ') + "/>") == "<a" + string(30, ' ') + "/>");
+static_assert(xml_split_boundaries());
+
+// The attributes of each element in xml as prefix:name=value, separated by |.
+static constexpr string xml_attributes(string_view xml) {
+	xml_reader r(xml);
+	string ret;
+	bool first = true;
+
+	while (r.read()) {
+		if (r.node_type() != xml_node::element)
+			continue;
+
+		if (!first)
+			ret += "|";
+
+		first = false;
+
+		string atts;
+
+		r.attributes_loop_raw([&](string_view local_name, string_view prefix, xml_enc_string_view, xml_enc_string_view value) {
+			if (!atts.empty())
+				atts += " ";
+
+			if (!prefix.empty()) {
+				atts += prefix;
+				atts += ":";
+			}
+
+			atts += local_name;
+			atts += "=";
+			atts += value.decode();
+
+			return true;
+		});
+
+		ret += atts;
+	}
+
+	return ret;
+}
+
+// The value get_attribute gives for the first element in xml.
+static constexpr string xml_get_attribute(string_view xml, string_view name, string_view ns = "") {
+	xml_reader r(xml);
+
+	while (r.read()) {
+		if (r.node_type() != xml_node::element)
+			continue;
+
+		if (auto v = r.get_attribute(name, ns))
+			return v->decode();
+
+		break;
+	}
+
+	return "(none)";
+}
+
+static_assert(xml_attributes("<a x=\"1\" x='2' y=\"3\"><b x=\"4\"/><c/></a>") == "x=1 x=2 y=3|x=4|");
+static_assert(xml_attributes("<a xmlns:p=\"u\" p:x=\"1\" p:x=\"&lt;\"/>") == "xmlns:p=u p:x=1 p:x=<");
+static_assert(xml_get_attribute("<a x=\"1\" x=\"2\"/>", "x") == "1");
+static_assert(xml_get_attribute("<a p:x=\"1\" x=\"2\" xmlns:p=\"u\"/>", "x") == "2");
+static_assert(xml_get_attribute("<a p:x=\"1\" q:x=\"2\" xmlns:p=\"u\" xmlns:q=\"u\"/>", "x", "u") == "1");
+static_assert(xml_get_attribute("<a p:x=\"1\" q:x=\"2\" xmlns:p=\"u\" xmlns:q=\"v\"/>", "x", "v") == "2");
+static_assert(xml_get_attribute("<a x=\"1\" x=\"2\"/>", "y") == "(none)");
+static_assert(xml_pretty2("<a x=\"1\" x=\"2\"/>") == "<a x=\"1\" x=\"2\" />\n");
+
+// Each element in xml as name{namespace}, followed by any prefixed attributes
+// the same way, separated by |.
+static constexpr string xml_namespaces(string_view xml) {
+	xml_reader r(xml);
+	string ret;
+
+	while (r.read()) {
+		if (r.node_type() != xml_node::element)
+			continue;
+
+		if (!ret.empty())
+			ret += "|";
+
+		ret += r.name();
+		ret += "{";
+		ret += r.namespace_uri_raw().decode();
+		ret += "}";
+
+		r.attributes_loop_raw([&](string_view local_name, string_view prefix, xml_enc_string_view namespace_uri, xml_enc_string_view) {
+			if (prefix.empty() || prefix == "xmlns")
+				return true;
+
+			ret += " ";
+			ret += prefix;
+			ret += ":";
+			ret += local_name;
+			ret += "{";
+			ret += namespace_uri.decode();
+			ret += "}";
+
+			return true;
+		});
+	}
+
+	return ret;
+}
+
+static_assert(xml_namespaces("<p:a xmlns:p=\"u\"><p:b xmlns:p=\"v\" p:x=\"1\"><p:c/></p:b><p:d p:x=\"1\"/></p:a>") == "p:a{u}|p:b{v} p:x{v}|p:c{v}|p:d{u} p:x{u}");
+static_assert(xml_namespaces("<p:a xmlns:p=\"u\"><p:b xmlns:p=\"v\"/><p:c/></p:a>") == "p:a{u}|p:b{v}|p:c{u}");
+static_assert(xml_namespaces("<a xmlns=\"u\"><b xmlns=\"\"><c/></b><d/></a>") == "a{u}|b{}|c{}|d{u}");
+static_assert(xml_namespaces("<a xmlns=\"u\" xmlns:p=\"v\"><b xmlns=\"\" p:x=\"1\"/><p:c/></a>") == "a{u}|b{} p:x{v}|p:c{v}");
+static_assert(xml_namespaces("<a xmlns:p=\"u\" xmlns:p=\"v\"><p:b/></a>") == "a{}|p:b{u}");
+
 extern "C" __declspec(dllexport) BSTR XML_PRETTY(WCHAR* in) noexcept {
-	u16string ws;
+	if (!in)
+		return nullptr;
+
+	try {
+		u16string_view inw = (char16_t*)in;
+
+		if (inw.starts_with(u'\xfeff')) // BOM
+			inw.remove_prefix(1);
 
+		utf16_source src(inw);
+		xml_reader r(src);
+		utf8_writer s;
+
+		s.reserve(inw.length());
+		xml_pretty2(r, s);
+
+		return bstr(s.str());
+	} catch (...) {
+		return nullptr;
+	}
+}
+
+extern "C" __declspec(dllexport) BSTR XML_PRETTY_U8(const char* in, UINT len) noexcept {
 	if (!in)
 		return nullptr;
 
 	try {
-		auto inu = utf16_to_utf8((char16_t*)in);
+		utf8_writer s;
 
-		ws = utf8_to_utf16(xml_pretty2(inu));
+		xml_pretty2(string_view(in, len), s);
+
+		return bstr_u8(s.str());
 	} catch (...) {
 		return nullptr;
 	}
+}
+
+extern "C" __declspec(dllexport) BSTR XML_PRETTY_DECOMPRESS(const char* in, UINT len) noexcept {
+	if (!in)
+		return nullptr;
+
+	try {
+		return from_compressed(in, len, compressed_output::utf16, [&](input_source& src, auto& s) {
+			xml_reader r(src);
+
+			xml_pretty2(r, s);
+		});
+	} catch (...) {
+		return nullptr;
+	}
+}
+
+extern "C" __declspec(dllexport) BSTR XML_PRETTY_DECOMPRESS_U8(const char* in, UINT len) noexcept {
+	if (!in)
+		return nullptr;
+
+	try {
+		return from_compressed(in, len, compressed_output::utf8, [&](input_source& src, auto& s) {
+			xml_reader r(src);
+
+			xml_pretty2(r, s);
+		});
+	} catch (...) {
+		return nullptr;
+	}
+}
+
+extern "C" __declspec(dllexport) BSTR XML_PRETTY_COMPRESS(const char* in, UINT len) noexcept {
+	if (!in)
+		return nullptr;
+
+	try {
+		return from_compressed(in, len, compressed_output::gzip, [&](input_source& src, auto& s) {
+			xml_reader r(src);
+
+			xml_pretty2(r, s);
+		});
+	} catch (...) {
+		return nullptr;
+	}
+}
+
+// Reads the XML file in_path, and writes it pretty-printed to out_path as UTF-8,
+// with memory use that doesn't depend on the size of either. The input can be
+// UTF-8, or UTF-16 with a BOM. Returns FALSE on error, leaving out_path as it
+// was.
+extern "C" __declspec(dllexport) BOOL XML_PRETTY_FILE(WCHAR* in_path, WCHAR* out_path) noexcept {
+	if (!in_path || !out_path)
+		return FALSE;
+
+	try {
+		file_source in(in_path);
+		file_writer out(out_path);
+		xml_reader r(in);
+
+		xml_pretty2(r, out);
+		out.finish();
+	} catch (...) {
+		return FALSE;
+	}
 
-	return bstr(ws);
+	return TRUE;
 }
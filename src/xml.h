@@ -4,7 +4,17 @@
 #include <functional>
 #include <optional>
 #include <vector>
+#include <array>
 #include <stdexcept>
+#include <bit>
+#include "source.h"
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#ifndef USE_SSE2
+#define USE_SSE2
+#endif
+#endif
 
 enum class xml_node {
 	none,
@@ -30,69 +40,510 @@ public:
 		return sv;
 	}
 
-	std::string decode() const;
-	bool cmp(std::string_view str) const;
+	constexpr std::string decode() const {
+		auto v = sv;
+		std::string s;
+
+		s.reserve(v.length());
+
+		while (!v.empty()) {
+			if (v.front() == '&') {
+				v.remove_prefix(1);
+
+				if (v.starts_with("amp;")) {
+					s += "&";
+					v.remove_prefix(4);
+				} else if (v.starts_with("lt;")) {
+					s += "<";
+					v.remove_prefix(3);
+				} else if (v.starts_with("gt;")) {
+					s += ">";
+					v.remove_prefix(3);
+				} else if (v.starts_with("quot;")) {
+					s += "\"";
+					v.remove_prefix(5);
+				} else if (v.starts_with("apos;")) {
+					s += "'";
+					v.remove_prefix(5);
+				} else if (v.starts_with("#")) {
+					std::string_view bit;
+
+					v.remove_prefix(1);
+
+					auto sc = v.find_first_of(';');
+					if (sc == std::string::npos) {
+						bit = v;
+						v = "";
+					} else {
+						bit = v.substr(0, sc);
+						v.remove_prefix(sc + 1);
+					}
+
+					esc_char(s, bit);
+				} else
+					s += "&";
+			} else {
+				s += v.front();
+				v.remove_prefix(1);
+			}
+		}
+
+		return s;
+	}
+
+	constexpr bool cmp(std::string_view str) const {
+		for (auto c : sv) {
+			if (c == '&')
+				return decode() == str;
+		}
+
+		return sv == str;
+	}
 
 private:
+	// Appends the character that e.g. &#233; or &#xe9; stands for. As with
+	// from_chars, the number stops at the first character that isn't a digit.
+	static constexpr void esc_char(std::string& s, std::string_view bit) {
+		uint32_t c = 0;
+		unsigned int base = 10;
+
+		if (bit.starts_with("x")) {
+			base = 16;
+			bit.remove_prefix(1);
+		}
+
+		for (auto d : bit) {
+			unsigned int v;
+
+			if (d >= '0' && d <= '9')
+				v = (unsigned int)(d - '0');
+			else if (base == 16 && d >= 'a' && d <= 'f')
+				v = (unsigned int)(d - 'a' + 10);
+			else if (base == 16 && d >= 'A' && d <= 'F')
+				v = (unsigned int)(d - 'A' + 10);
+			else
+				break;
+
+			c = (c * base) + v;
+
+			if (c > 0x10ffff)
+				return;
+		}
+
+		if (c == 0)
+			return;
+
+		if (c < 0x80)
+			s += (char)c;
+		else if (c < 0x800) {
+			s += (char)(0xc0 | (c >> 6));
+			s += (char)(0x80 | (c & 0x3f));
+		} else if (c < 0x10000) {
+			s += (char)(0xe0 | (c >> 12));
+			s += (char)(0x80 | ((c >> 6) & 0x3f));
+			s += (char)(0x80 | (c & 0x3f));
+		} else {
+			s += (char)(0xf0 | (c >> 18));
+			s += (char)(0x80 | ((c >> 12) & 0x3f));
+			s += (char)(0x80 | ((c >> 6) & 0x3f));
+			s += (char)(0x80 | (c & 0x3f));
+		}
+	}
+
 	std::string_view sv;
 };
 
-using ns_list = std::vector<std::pair<std::string_view, xml_enc_string_view>>;
+// An attribute of the current element, as views into its tag.
+struct xml_attribute {
+	std::string_view local_name;
+	std::string_view prefix;
+	xml_enc_string_view value;
+};
 
 class xml_reader {
 public:
 	constexpr xml_reader(std::string_view sv) : sv(sv) { }
+	xml_reader(input_source& source) : source(&source), eof(false) { }
 
 	constexpr bool read() {
-		if (sv.empty())
-			return false;
-
 		// FIXME - DOCTYPE (<!DOCTYPE greeting SYSTEM "hello.dtd">, <!DOCTYPE greeting [ <!ELEMENT greeting (#PCDATA)> ]>)
 
 		if (type == xml_node::element && empty_tag)
-			namespaces.pop_back();
+			pop_scope();
+
+		type = xml_node::none;
+
+		while (true) {
+			if (sv.empty() && eof)
+				return false;
+
+			auto start = sv;
+
+			if (!sv.empty() && next_node())
+				return true;
+
+			sv = start;
+
+			if (!more())
+				eof = true;
+		}
+	}
+
+	constexpr enum xml_node node_type() const {
+		return type;
+	}
+
+	constexpr bool is_empty() const {
+		return type == xml_node::element && empty_tag;
+	}
+
+	template<typename T>
+	requires std::is_invocable_r_v<bool, T, std::string_view, std::string_view, xml_enc_string_view, xml_enc_string_view>
+	constexpr void attributes_loop_raw(T func) const {
+		if (type != xml_node::element)
+			return;
+
+		for (const auto& a : attributes) {
+			if (!func(a.local_name, a.prefix, a.prefix.empty() ? xml_enc_string_view{} : namespace_for(a.prefix), a.value))
+				return;
+		}
+	}
+
+	// The namespace is only looked up for attributes with the right local name.
+	constexpr std::optional<xml_enc_string_view> get_attribute(std::string_view name, std::string_view ns = "") const {
+		if (type != xml_node::element)
+			return std::nullopt;
+
+		for (const auto& a : attributes) {
+			if (a.local_name != name)
+				continue;
+
+			auto uri = a.prefix.empty() ? xml_enc_string_view{} : namespace_for(a.prefix);
+
+			if (uri.cmp(ns))
+				return a.value;
+		}
+
+		return std::nullopt;
+	}
+
+	constexpr xml_enc_string_view namespace_uri_raw() const {
+		auto tag = name();
+		auto colon = tag.find_first_of(':');
+		std::string_view prefix;
+
+		if (colon != std::string::npos)
+			prefix = tag.substr(0, colon);
+
+		return namespace_for(prefix);
+	}
+
+	// The URI that prefix is bound to at the current node, or empty if it isn't.
+	constexpr xml_enc_string_view namespace_uri_raw(std::string_view prefix) const {
+		return namespace_for(prefix);
+	}
+
+	constexpr std::string_view name() const {
+		if (type != xml_node::element && type != xml_node::end_element)
+			return "";
+
+		auto tag = node.substr(type == xml_node::end_element ? 2 : 1);
+
+		tag.remove_suffix(1);
+
+		for (size_t i = 0; i < tag.length(); i++) {
+			if (is_whitespace(tag[i])) {
+				tag = tag.substr(0, i);
+				break;
+			}
+		}
+
+		if (is_empty()) {
+			while (!tag.empty() && (tag.back() == '/' || is_whitespace(tag.back()))) {
+				tag.remove_suffix(1);
+			}
+		}
+
+		return tag;
+	}
+
+	constexpr std::string_view local_name() const {
+		if (type != xml_node::element && type != xml_node::end_element)
+			return "";
+
+		auto tag = name();
+		auto pos = tag.find_first_of(':');
+
+		if (pos == std::string::npos)
+			return tag;
+		else
+			return tag.substr(pos + 1);
+	}
+
+	constexpr std::string value() const {
+		switch (type) {
+			case xml_node::text:
+				return xml_enc_string_view{node}.decode();
+
+			case xml_node::cdata:
+				return std::string{node.substr(9, node.length() - 12)};
+
+			default:
+				return {};
+		}
+	}
+
+	constexpr std::string_view raw() const {
+		return node;
+	}
+
+private:
+	// The namespace declarations in scope are kept in one flat list, innermost
+	// last, with their text copied into ns_text - as a streaming reader discards
+	// input once it has been read. Each is also on a chain from a small hash
+	// table of prefixes, innermost first, so that a lookup finds the binding in
+	// force without looking at any other prefix. Everything is reused from
+	// element to element, so an element that declares nothing allocates nothing.
+	struct ns_decl {
+		size_t prefix_off;
+		size_t prefix_len;
+		size_t uri_off;
+		size_t uri_len;
+		size_t next; // in the same bucket
+	};
+
+	static constexpr size_t ns_buckets = 32;
+	static constexpr size_t no_decl = (size_t)-1;
+
+	static constexpr std::array<size_t, ns_buckets> make_ns_heads() {
+		std::array<size_t, ns_buckets> a;
+
+		a.fill(no_decl);
+
+		return a;
+	}
+
+	static constexpr size_t ns_bucket(std::string_view prefix) {
+		size_t h = 0;
+
+		for (auto c : prefix) {
+			h = (h * 31) + (uint8_t)c;
+		}
+
+		return h % ns_buckets;
+	}
+
+	constexpr void push_namespace(std::string_view prefix, std::string_view uri) {
+		auto& head = ns_heads[ns_bucket(prefix)];
+
+		// if a tag declares a prefix twice, the first one wins
+		for (auto i = head; i != no_decl && i >= ns_scopes.back(); i = ns_decls[i].next) {
+			if (std::string_view(ns_text).substr(ns_decls[i].prefix_off, ns_decls[i].prefix_len) == prefix)
+				return;
+		}
 
+		ns_decls.push_back({ns_text.length(), prefix.length(), ns_text.length() + prefix.length(), uri.length(), head});
+		ns_text += prefix;
+		ns_text += uri;
+		head = ns_decls.size() - 1;
+	}
+
+	constexpr void pop_scope() {
+		if (ns_scopes.empty())
+			return;
+
+		auto start = ns_scopes.back();
+
+		ns_scopes.pop_back();
+
+		if (start == ns_decls.size())
+			return;
+
+		while (ns_decls.size() > start) {
+			const auto& d = ns_decls.back();
+
+			ns_heads[ns_bucket(std::string_view(ns_text).substr(d.prefix_off, d.prefix_len))] = d.next;
+			ns_decls.pop_back();
+		}
+
+		ns_text.resize(ns_decls.empty() ? 0 : ns_decls.back().uri_off + ns_decls.back().uri_len);
+	}
+
+	// The view is into ns_text, so only lasts until the next read().
+	constexpr xml_enc_string_view namespace_for(std::string_view prefix) const {
+		for (auto i = ns_heads[ns_bucket(prefix)]; i != no_decl; i = ns_decls[i].next) {
+			const auto& d = ns_decls[i];
+
+			if (std::string_view(ns_text).substr(d.prefix_off, d.prefix_len) == prefix)
+				return xml_enc_string_view{std::string_view(ns_text).substr(d.uri_off, d.uri_len)};
+		}
+
+		// bound by the XML namespaces spec without having to be declared
+		if (prefix == "xml")
+			return xml_enc_string_view{"http://www.w3.org/XML/1998/namespace"};
+
+		return {};
+	}
+
+	static constexpr bool __inline is_whitespace(char c) {
+		return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+	}
+
+	// Bit i is set if p[i] is c, for the 16 bytes from p.
+	static constexpr unsigned int match(const char* p, char c) {
+#ifdef USE_SSE2
+		if (!std::is_constant_evaluated())
+			return (unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)p), _mm_set1_epi8(c)));
+#endif
+
+		unsigned int m = 0;
+
+		for (unsigned int i = 0; i < 16; i++) {
+			if (p[i] == c)
+				m |= 1u << i;
+		}
+
+		return m;
+	}
+
+	// The searches next_node() makes, 16 bytes at a time - which in constant
+	// evaluation is the same code, with match() done a byte at a time. Most
+	// tags are short, so only the first 32 bytes are checked like this. Beyond
+	// that it's left to memchr, which the C runtime picks the widest
+	// instructions for when it's loaded.
+	static constexpr size_t find(std::string_view sv, char c) {
+		size_t i = 0;
+
+		while (i < 32 && i + 16 <= sv.length()) {
+			if (auto m = match(sv.data() + i, c))
+				return i + (size_t)std::countr_zero(m);
+
+			i += 16;
+		}
+
+		return sv.find(c, i);
+	}
+
+	// Looks for where the first two characters of str appear together, then
+	// checks for the rest - so "-" on its own in a comment doesn't stop the
+	// scan. As above, anything long is left to the C runtime.
+	static constexpr size_t find(std::string_view sv, std::string_view str) {
+		size_t i = 0;
+
+		while (i < 64 && i + 17 <= sv.length()) {
+			auto m = match(sv.data() + i, str[0]) & match(sv.data() + i + 1, str[1]);
+
+			while (m != 0) {
+				auto pos = i + (size_t)std::countr_zero(m);
+
+				if (sv.substr(pos).starts_with(str))
+					return pos;
+
+				m &= m - 1;
+			}
+
+			i += 16;
+		}
+
+		return sv.find(str, i);
+	}
+
+	// Finds the '<' that ends a text node, and whether what comes before it is
+	// all whitespace - or if there isn't one, whether all of sv is.
+	static constexpr size_t find_text_end(std::string_view sv, bool& whitespace) {
+		size_t i = 0;
+
+		whitespace = true;
+
+		while (i + 16 <= sv.length()) {
+			auto p = sv.data() + i;
+			auto lt = match(p, '<');
+			auto ws = match(p, ' ') | match(p, '\t') | match(p, '\r') | match(p, '\n');
+
+			if (lt != 0) {
+				// bits for the characters before the '<'
+				auto before = (lt & (0 - lt)) - 1;
+
+				if ((ws & before) != before)
+					whitespace = false;
+
+				return i + (size_t)std::countr_zero(lt);
+			}
+
+			i += 16;
+
+			if (ws != 0xffff) {
+				whitespace = false;
+
+				auto pos = find(sv.substr(i), '<');
+
+				return pos == std::string::npos ? pos : i + pos;
+			}
+		}
+
+		for (; i < sv.length(); i++) {
+			if (sv[i] == '<')
+				return i;
+
+			if (!is_whitespace(sv[i]))
+				whitespace = false;
+		}
+
+		return std::string::npos;
+	}
+
+	// Returns false if the node runs past the end of the buffer, in which case
+	// read() fetches more input and tries again.
+	constexpr bool next_node() {
 		if (sv.front() != '<') { // text
-			if (auto pos = sv.find_first_of('<'); pos != std::string::npos) {
+			bool whitespace;
+
+			if (auto pos = find_text_end(sv, whitespace); pos != std::string::npos) {
 				node = sv.substr(0, pos);
 				sv = sv.substr(pos);
-			} else {
+			} else if (!eof)
+				return false;
+			else {
 				node = sv;
 				sv = "";
 			}
 
-			type = xml_node::whitespace;
-
-			for (auto c : node) {
-				if (!is_whitespace(c)) {
-					type = xml_node::text;
-					break;
-				}
-			}
+			type = whitespace ? xml_node::whitespace : xml_node::text;
 		} else {
+			// make sure we can tell <![CDATA[ from an element name
+			if (sv.length() < 9 && !eof)
+				return false;
+
 			if (sv.starts_with("<?")) {
-				if (auto pos = sv.find("?>"); pos != std::string::npos) {
+				if (auto pos = find(sv, "?>"); pos != std::string::npos) {
 					node = sv.substr(0, pos + 2);
 					sv = sv.substr(pos + 2);
-				} else {
+				} else if (!eof)
+					return false;
+				else {
 					node = sv;
 					sv = "";
 				}
 
 				type = xml_node::processing_instruction;
 			} else if (sv.starts_with("</")) {
-				if (auto pos = sv.find_first_of('>'); pos != std::string::npos) {
+				if (auto pos = find(sv, '>'); pos != std::string::npos) {
 					node = sv.substr(0, pos + 1);
 					sv = sv.substr(pos + 1);
-				} else {
+				} else if (!eof)
+					return false;
+				else {
 					node = sv;
 					sv = "";
 				}
 
 				type = xml_node::end_element;
-				namespaces.pop_back();
+				pop_scope();
 			} else if (sv.starts_with("<!--")) {
-				auto pos = sv.find("-->");
+				auto pos = find(sv, "-->");
+
+				if (pos == std::string::npos && !eof)
+					return false;
 
 				if (pos == std::string::npos)
 					throw std::runtime_error("Malformed comment.");
@@ -102,7 +553,10 @@ public:
 
 				type = xml_node::comment;
 			} else if (sv.starts_with("<![CDATA[")) {
-				auto pos = sv.find("]]>");
+				auto pos = find(sv, "]]>");
+
+				if (pos == std::string::npos && !eof)
+					return false;
 
 				if (pos == std::string::npos)
 					throw std::runtime_error("Malformed CDATA.");
@@ -112,28 +566,37 @@ public:
 
 				type = xml_node::cdata;
 			} else {
-				if (auto pos = sv.find_first_of('>'); pos != std::string::npos) {
+				if (auto pos = find(sv, '>'); pos != std::string::npos) {
 					node = sv.substr(0, pos + 1);
 					sv = sv.substr(pos + 1);
-				} else {
+				} else if (!eof)
+					return false;
+				else {
 					node = sv;
 					sv = "";
 				}
 
 				type = xml_node::element;
-				ns_list ns;
+				ns_scopes.push_back(ns_decls.size());
+
+				// The attributes are split up here once, into a buffer that's
+				// reused from element to element.
+				attributes.clear();
 
 				parse_attributes(node, [&](std::string_view name, xml_enc_string_view value) {
 					if (name.starts_with("xmlns:"))
-						ns.emplace_back(name.substr(6), value);
+						push_namespace(name.substr(6), value.raw());
 					else if (name == "xmlns")
-						ns.emplace_back("", value);
+						push_namespace("", value.raw());
+
+					if (auto colon = name.find(':'); colon != std::string::npos)
+						attributes.push_back({name.substr(colon + 1), name.substr(0, colon), value});
+					else
+						attributes.push_back({name, {}, value});
 
 					return true;
 				});
 
-				namespaces.push_back(ns);
-
 				empty_tag = node.ends_with("/>");
 			}
 		}
@@ -141,76 +604,29 @@ public:
 		return true;
 	}
 
-	constexpr enum xml_node node_type() const {
-		return type;
-	}
-
-	constexpr bool is_empty() const {
-		return type == xml_node::element && empty_tag;
-	}
-
-	template<typename T>
-	requires std::is_invocable_r_v<bool, T, std::string_view, std::string_view, xml_enc_string_view, xml_enc_string_view>
-	constexpr void attributes_loop_raw(T func) const {
-		if (type != xml_node::element)
-			return;
+	// Moves the unread part of the buffer to the front, and appends the next chunk.
+	constexpr bool more() {
+		if (!source)
+			return false;
 
-		parse_attributes(node, [&](std::string_view name, xml_enc_string_view value_raw) {
-			auto colon = name.find_first_of(':');
+		auto keep = sv.length();
 
-			if (colon == std::string::npos)
-				return func(name, "", xml_enc_string_view{}, value_raw);
+		if (keep == 0)
+			buf.clear();
+		else if (sv.data() != buf.data())
+			buf.erase(0, (size_t)(sv.data() - buf.data()));
 
-			auto prefix = name.substr(0, colon);
+		// a node that's still incomplete is parsed again from its start, so grow
+		// the read with it, as json_reader does
+		auto want = keep + (keep > input_source::chunk_size ? keep : input_source::chunk_size);
 
-			for (auto it = namespaces.rbegin(); it != namespaces.rend(); it++) {
-				for (const auto& v : *it) {
-					if (v.first == prefix)
-						return func(name.substr(colon + 1), prefix, v.second, value_raw);
-				}
-			}
-
-			return func(name.substr(colon + 1), prefix, xml_enc_string_view{}, value_raw);
+		buf.resize_and_overwrite(want, [&](char* p, size_t n) {
+			return keep + source->read(p + keep, n - keep);
 		});
-	}
-
-	std::optional<xml_enc_string_view> get_attribute(std::string_view name, std::string_view ns = "") const;
-	xml_enc_string_view namespace_uri_raw() const;
 
-	constexpr std::string_view name() const {
-		if (type != xml_node::element && type != xml_node::end_element)
-			return "";
-
-		auto tag = node.substr(type == xml_node::end_element ? 2 : 1);
-
-		tag.remove_suffix(1);
-
-		for (size_t i = 0; i < tag.length(); i++) {
-			if (is_whitespace(tag[i])) {
-				tag = tag.substr(0, i);
-				break;
-			}
-		}
+		sv = buf;
 
-		if (is_empty()) {
-			while (!tag.empty() && (tag.back() == '/' || is_whitespace(tag.back()))) {
-				tag.remove_suffix(1);
-			}
-		}
-
-		return tag;
-	}
-
-	std::string_view local_name() const;
-	std::string value() const;
-
-	constexpr std::string_view raw() const {
-		return node;
-	}
-
-private:
-	static constexpr bool __inline is_whitespace(char c) {
-		return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+		return buf.length() > keep;
 	}
 
 	template<typename T>
@@ -286,5 +702,12 @@ private:
 	std::string_view sv, node;
 	enum xml_node type = xml_node::none;
 	bool empty_tag;
-	std::vector<ns_list> namespaces;
+	std::vector<ns_decl> ns_decls;
+	std::vector<size_t> ns_scopes; // the first of each element's declarations
+	std::array<size_t, ns_buckets> ns_heads = make_ns_heads();
+	std::string ns_text;
+	std::vector<xml_attribute> attributes;
+	input_source* source = nullptr;
+	bool eof = true;
+	std::string buf;
 };